@@ -0,0 +1,211 @@
+#pragma once
+
+#include "grid.h"
+#include "solver.h"
+
+#include "arena.cc"
+#include "slice.cc"
+
+#include <sys/types.h>
+
+// Finds every pattern on the grid in one pass with the Baker-Bird algorithm,
+// using the automata codegen --bird builds from the patterns. A row
+// automaton reads each grid row as a string of cell classes and says, at
+// every cell, which pattern rows end there; that answer is one symbol of a
+// column automaton that runs down every column and says which patterns have
+// all their rows stacked up, with their bottom right corner at the cell.
+//
+// The scan runs at the start of each epoch and records the actions of every
+// match on the cells they are for, which the rule then takes as the solver
+// gets to them, like the other whole-grid rules do with their verdicts.
+
+enum BirdActionKind : unsigned char {
+    bak_flag = 1 << 0,
+    bak_execute = 1 << 1,
+};
+
+struct BirdAction {
+    unsigned char row; // from the top left of the match
+    unsigned char col;
+    BirdActionKind kind;
+};
+
+struct BirdVariant {
+    unsigned char height;
+    unsigned char width;
+    unsigned short first_action;
+    unsigned short action_count;
+};
+
+// the classes the row automaton reads: hidden, flag, maybe flag, mine, then
+// numbers by effective number (9 and up share one)
+static constexpr size_t bird_classes = 15;
+
+static inline auto birdClass(Cell cell) -> unsigned {
+    switch (cell.display_type) {
+    case CellDisplayType::cdt_hidden:
+        return 0;
+    case CellDisplayType::cdt_flag:
+        return 1;
+    case CellDisplayType::cdt_maybe_flag:
+        return 2;
+    case CellDisplayType::cdt_value:
+        break;
+    }
+
+    if (cell.type == CellType::ct_mine) {
+        return 3;
+    }
+    return 4 + (cell.eff_number < 9 ? cell.eff_number : 9);
+}
+
+struct BirdTables {
+    unsigned short const *row_next; // [row state][class]
+    unsigned short const *row_out;  // row state -> column symbol
+    size_t symbol_count;
+    unsigned short const *col_next; // [column state][symbol]
+    // the variants ending in column state s are col_matches[col_ends[s]]
+    // up to col_matches[col_ends[s + 1]]
+    unsigned int const *col_ends;
+    unsigned short const *col_matches;
+    BirdVariant const *variants;
+    BirdAction const *actions;
+};
+
+struct BakerBirdRule {
+    static auto applyRule(Grid *grid, GridApi api, size_t row, size_t col,
+                          void *data) -> bool {
+        auto rule = static_cast<BakerBirdRule *>(data);
+        return rule->apply(grid, api, row, col);
+    }
+
+    static auto onEpochStart(Grid *grid, GridApi, void *data) -> void {
+        auto rule = static_cast<BakerBirdRule *>(data);
+        rule->onStart(grid);
+    }
+
+    BirdTables const *tables;
+    Arena arena;
+    Dims dims;
+
+    Slice<unsigned short> col_states; // per column, over the current row
+    Slice<unsigned char> actions;     // BirdActionKind bits, per cell
+
+    auto apply(Grid *grid, GridApi api, size_t row, size_t col) -> bool {
+        size_t idx = row * grid->dims.width + col;
+        if (idx >= this->actions.len || this->actions[idx] == 0) {
+            return false;
+        }
+
+        unsigned char kinds = this->actions[idx];
+        Cell *cell = &(*grid)[row][col];
+        bool did_work = false;
+
+        if ((kinds & BirdActionKind::bak_flag) &&
+            (cell->display_type == CellDisplayType::cdt_hidden ||
+             cell->display_type == CellDisplayType::cdt_maybe_flag)) {
+            api.flagCell(grid, cell);
+            did_work = true;
+        }
+
+        if ((kinds & BirdActionKind::bak_execute) &&
+            (cell->display_type == CellDisplayType::cdt_hidden ||
+             cell->display_type == CellDisplayType::cdt_maybe_flag)) {
+            // unflag to remove possible maybe_flag
+            if (cell->display_type == CellDisplayType::cdt_maybe_flag) {
+                api.unflagCell(grid, cell);
+            }
+            api.uncoverSelfAndNeighbors(grid, cell);
+            did_work = true;
+        }
+
+        return did_work;
+    }
+
+    auto onStart(Grid *grid) -> void {
+        if (this->dims.width != grid->dims.width ||
+            this->dims.height != grid->dims.height) {
+            this->reserve(grid->dims);
+        }
+
+        this->scan(grid);
+    }
+
+    auto scan(Grid *grid) -> void {
+        BirdTables const *tables = this->tables;
+
+        for (unsigned short &state : this->col_states) {
+            state = 0;
+        }
+        for (unsigned char &kinds : this->actions) {
+            kinds = 0;
+        }
+
+        for (size_t row = 0; row < grid->dims.height; ++row) {
+            unsigned short row_state = 0;
+
+            for (size_t col = 0; col < grid->dims.width; ++col) {
+                unsigned cls = birdClass((*grid)[row][col]);
+                row_state = tables->row_next[row_state * bird_classes + cls];
+
+                unsigned short &col_state = this->col_states[col];
+                col_state = tables->col_next[col_state * tables->symbol_count +
+                                             tables->row_out[row_state]];
+
+                unsigned int end = tables->col_ends[col_state + 1];
+                for (unsigned int i = tables->col_ends[col_state]; i < end;
+                     ++i) {
+                    this->record(grid, row, col, tables->col_matches[i]);
+                }
+            }
+        }
+    }
+
+    // the variant matched with its bottom right corner at row, col
+    auto record(Grid *grid, size_t row, size_t col, size_t v) -> void {
+        BirdVariant variant = this->tables->variants[v];
+        size_t top = row + 1 - variant.height;
+        size_t left = col + 1 - variant.width;
+
+        for (size_t i = 0; i < variant.action_count; ++i) {
+            BirdAction action =
+                this->tables->actions[variant.first_action + i];
+            size_t idx =
+                (top + action.row) * grid->dims.width + left + action.col;
+            this->actions[idx] |= action.kind;
+        }
+    }
+
+    auto reserve(Dims dims) -> void {
+        size_t cell_count = dims.area();
+        size_t needed = cell_count + dims.width * sizeof(unsigned short) + 64;
+
+        if (this->arena.cap < needed) {
+            if (this->arena.ptr != nullptr) {
+                freeArena(&this->arena);
+            }
+            this->arena = makeArena(needed);
+        }
+        this->arena.reset(0);
+
+        this->dims = dims;
+
+        this->col_states = Slice<unsigned short>{
+            this->arena.pushTN<unsigned short>(dims.width, 0), dims.width};
+        this->actions = Slice<unsigned char>{
+            this->arena.pushTN<unsigned char>(cell_count, 0), cell_count};
+    }
+};
+
+auto makeBakerBird(BirdTables const *tables) -> BakerBirdRule {
+    BakerBirdRule rule{};
+    rule.tables = tables;
+    return rule;
+}
+
+auto deleteBakerBird(BakerBirdRule *rule) -> void {
+    if (rule->arena.ptr != nullptr) {
+        freeArena(&rule->arena);
+    }
+    *rule = BakerBirdRule{};
+}
@@ -0,0 +1,341 @@
+#pragma once
+
+#include "grid.h"
+
+#include "arena.cc"
+#include "dirutils.cc"
+#include "slice.cc"
+
+#include <assert.h>
+#include <stdint.h>
+
+// A grid as planes of one bit per cell, 64 cells to a word and every row
+// starting on a new word. Bits past the width of a row are always zero, so
+// counts can be taken a whole word at a time without masking.
+struct Bitboard {
+    Dims dims;
+    size_t mine_count;
+    size_t stride; // words per row
+
+    Slice<uint64_t> mines;
+    // a maybe_flag is in both of these, which keeps the conversion lossless
+    Slice<uint64_t> hidden;
+    Slice<uint64_t> flags;
+
+    static auto strideOf(Dims dims) -> size_t { return (dims.width + 63) / 64; }
+
+    static auto planeSize(Dims dims) -> size_t {
+        return strideOf(dims) * dims.height * sizeof(uint64_t);
+    }
+
+    // everything gridFromBitboard needs on top of the bitboard itself: the
+    // cells, two masked planes and three counts of four planes each
+    static auto arenaSize(Dims dims) -> size_t {
+        return dims.area() * sizeof(Cell) + 14 * planeSize(dims) + 64;
+    }
+
+    auto get(Slice<uint64_t> plane, size_t row, size_t col) -> bool {
+        uint64_t word = plane[row * this->stride + col / 64];
+        return (word >> (col % 64)) & 1;
+    }
+
+    auto set(Slice<uint64_t> plane, size_t row, size_t col) -> void {
+        plane[row * this->stride + col / 64] |= (uint64_t)1 << (col % 64);
+    }
+};
+
+static inline auto lowCount(uint64_t const (&words)[4]) -> unsigned char {
+    return (words[0] & 1) | ((words[1] & 1) << 1) | ((words[2] & 1) << 2) |
+           ((words[3] & 1) << 3);
+}
+
+static inline auto sliceCount(uint64_t const (&words)[4], size_t bit)
+    -> unsigned char {
+    return ((words[0] >> bit) & 1) | (((words[1] >> bit) & 1) << 1) |
+           (((words[2] >> bit) & 1) << 2) | (((words[3] >> bit) & 1) << 3);
+}
+
+// The number of set neighbors of every cell of a plane, bit sliced: bit k of
+// a cell's count is its bit in bits[k].
+struct BitCounts {
+    size_t stride;
+    Slice<uint64_t> bits[4];
+
+    auto at(size_t row, size_t col) -> unsigned char {
+        size_t idx = row * this->stride + col / 64;
+        uint64_t words[4] = {this->bits[0][idx], this->bits[1][idx],
+                             this->bits[2][idx], this->bits[3][idx]};
+        return sliceCount(words, col % 64);
+    }
+};
+
+auto makePlane(Arena *arena, Dims dims) -> Slice<uint64_t> {
+    size_t words = Bitboard::strideOf(dims) * dims.height;
+    return Slice<uint64_t>{arena->pushTN<uint64_t>(words, 0), words};
+}
+
+auto makeBitboard(Arena *arena, Dims dims, size_t mine_count) -> Bitboard {
+    Bitboard board{};
+    board.dims = dims;
+    board.mine_count = mine_count;
+    board.stride = Bitboard::strideOf(dims);
+    board.mines = makePlane(arena, dims);
+    board.hidden = makePlane(arena, dims);
+    board.flags = makePlane(arena, dims);
+    return board;
+}
+
+auto bitboardFromGrid(Arena *arena, Grid grid) -> Bitboard {
+    Bitboard board = makeBitboard(arena, grid.dims, grid.mine_count);
+
+    for (size_t row = 0; row < grid.dims.height; ++row) {
+        for (size_t col = 0; col < grid.dims.width; ++col) {
+            Cell cell = grid[row][col];
+
+            if (cell.type == CellType::ct_mine) {
+                board.set(board.mines, row, col);
+            }
+
+            switch (cell.display_type) {
+            case cdt_hidden: {
+                board.set(board.hidden, row, col);
+            } break;
+            case cdt_value: {
+            } break;
+            case cdt_flag: {
+                board.set(board.flags, row, col);
+            } break;
+            case cdt_maybe_flag: {
+                board.set(board.hidden, row, col);
+                board.set(board.flags, row, col);
+            } break;
+            }
+        }
+    }
+
+    return board;
+}
+
+static inline auto fullAdd(uint64_t a, uint64_t b, uint64_t c, uint64_t *carry)
+    -> uint64_t {
+    *carry = (a & b) | (c & (a ^ b));
+    return a ^ b ^ c;
+}
+
+static inline auto planeRow(Slice<uint64_t> plane, size_t stride, size_t row)
+    -> Slice<uint64_t> {
+    return plane.slice(row * stride, (row + 1) * stride);
+}
+
+// word w of the row shifted so every cell lines up with its left neighbor
+static inline auto leftOf(Slice<uint64_t> row, size_t w) -> uint64_t {
+    uint64_t carry = w > 0 ? row[w - 1] >> 63 : 0;
+    return (row[w] << 1) | carry;
+}
+
+// and with its right neighbor
+static inline auto rightOf(Slice<uint64_t> row, size_t w) -> uint64_t {
+    uint64_t carry = w + 1 < row.len ? row[w + 1] << 63 : 0;
+    return (row[w] >> 1) | carry;
+}
+
+// The eight neighbors are added as bit slices, so one pass over a row of words
+// counts 64 cells at a time: the three cells above and the three below are
+// each summed to two bits, the two beside to two bits, and those three sums
+// are added to the four bits a count of up to 8 needs.
+auto countNeighbors(Arena *arena, Dims dims, Slice<uint64_t> plane)
+    -> BitCounts {
+    BitCounts counts{};
+    counts.stride = Bitboard::strideOf(dims);
+    for (size_t k = 0; k < 4; ++k) {
+        counts.bits[k] = makePlane(arena, dims);
+    }
+
+    size_t stride = counts.stride;
+    size_t last_bits = dims.width % 64;
+    uint64_t last_mask =
+        last_bits == 0 ? ~(uint64_t)0 : ((uint64_t)1 << last_bits) - 1;
+
+    for (size_t row = 0; row < dims.height; ++row) {
+        for (size_t w = 0; w < stride; ++w) {
+            uint64_t up0 = 0, up1 = 0;
+            if (row > 0) {
+                Slice<uint64_t> up = planeRow(plane, stride, row - 1);
+                up0 = fullAdd(leftOf(up, w), up[w], rightOf(up, w), &up1);
+            }
+
+            uint64_t down0 = 0, down1 = 0;
+            if (row + 1 < dims.height) {
+                Slice<uint64_t> down = planeRow(plane, stride, row + 1);
+                down0 = fullAdd(leftOf(down, w), down[w], rightOf(down, w),
+                                &down1);
+            }
+
+            Slice<uint64_t> cur = planeRow(plane, stride, row);
+            uint64_t side0 = leftOf(cur, w) ^ rightOf(cur, w);
+            uint64_t side1 = leftOf(cur, w) & rightOf(cur, w);
+
+            uint64_t carry0, carry1;
+            uint64_t bit0 = fullAdd(up0, down0, side0, &carry0);
+            uint64_t sum1 = fullAdd(up1, down1, side1, &carry1);
+            uint64_t bit1 = sum1 ^ carry0;
+            uint64_t carry2 = sum1 & carry0;
+            uint64_t bit2 = carry1 ^ carry2;
+            uint64_t bit3 = carry1 & carry2;
+
+            // the shifts carry bits past the width into the last word
+            uint64_t mask = w + 1 == stride ? last_mask : ~(uint64_t)0;
+
+            size_t idx = row * stride + w;
+            counts.bits[0][idx] = bit0 & mask;
+            counts.bits[1][idx] = bit1 & mask;
+            counts.bits[2][idx] = bit2 & mask;
+            counts.bits[3][idx] = bit3 & mask;
+        }
+    }
+
+    return counts;
+}
+
+// Numbers, effective numbers and hidden counts are all derived from the
+// planes, the same way flagCell and uncoverSelfAndNeighbors would have kept
+// them.
+auto gridFromBitboard(Arena *arena, Bitboard board) -> Grid {
+    size_t cell_count = board.dims.area();
+
+    Cell *cells = arena->pushTN<Cell>(cell_count);
+    Grid grid{Slice<Cell>{cells, cell_count}, board.dims, board.mine_count};
+    grid.scratch = arena;
+
+    auto mark = arena->mark();
+
+    Slice<uint64_t> real_flags = makePlane(arena, board.dims);
+    Slice<uint64_t> real_hidden = makePlane(arena, board.dims);
+    for (size_t idx = 0; idx < real_flags.len; ++idx) {
+        real_flags[idx] = board.flags[idx] & ~board.hidden[idx];
+        real_hidden[idx] = board.hidden[idx] & ~board.flags[idx];
+    }
+
+    BitCounts numbers = countNeighbors(arena, board.dims, board.mines);
+    BitCounts flagged = countNeighbors(arena, board.dims, real_flags);
+    BitCounts hidden = countNeighbors(arena, board.dims, real_hidden);
+
+    // a word at a time, so every plane is read once
+    size_t width = board.dims.width;
+    for (size_t row = 0; row < board.dims.height; ++row) {
+        for (size_t w = 0; w < board.stride; ++w) {
+            size_t idx = row * board.stride + w;
+            uint64_t mines = board.mines[idx];
+            uint64_t hidden_cells = board.hidden[idx];
+            uint64_t flag_cells = board.flags[idx];
+
+            uint64_t number_bits[4], flagged_bits[4], hidden_bits[4];
+            for (size_t k = 0; k < 4; ++k) {
+                number_bits[k] = numbers.bits[k][idx] & ~mines;
+                flagged_bits[k] = flagged.bits[k][idx];
+                hidden_bits[k] = hidden.bits[k][idx];
+            }
+
+            size_t col_start = w * 64;
+            size_t col_end = col_start + 64 < width ? col_start + 64 : width;
+            Cell *cell = grid.cells.ptr + row * width + col_start;
+
+            // the words are shifted down as the cells are written, so every
+            // cell reads bit 0
+            uint64_t mine_word = mines;
+            uint64_t hidden_word = hidden_cells;
+            uint64_t flag_word = flag_cells;
+            for (size_t col = col_start; col < col_end; ++col, ++cell) {
+                unsigned char number = lowCount(number_bits);
+                unsigned char flagged_count = lowCount(flagged_bits);
+                unsigned char hidden_count = lowCount(hidden_bits);
+
+                // hidden and flag together are a maybe_flag, neither is a
+                // revealed cell
+                static constexpr CellDisplayType display_of[4] = {
+                    CellDisplayType::cdt_value, CellDisplayType::cdt_hidden,
+                    CellDisplayType::cdt_flag, CellDisplayType::cdt_maybe_flag};
+                CellDisplayType display_type =
+                    display_of[(hidden_word & 1) | ((flag_word & 1) << 1)];
+
+                *cell = Cell{(mine_word & 1) ? CellType::ct_mine
+                                             : CellType::ct_number,
+                             display_type, number,
+                             (unsigned char)(number - flagged_count),
+                             hidden_count};
+
+                mine_word >>= 1;
+                hidden_word >>= 1;
+                flag_word >>= 1;
+                for (size_t k = 0; k < 4; ++k) {
+                    number_bits[k] >>= 1;
+                    flagged_bits[k] >>= 1;
+                    hidden_bits[k] >>= 1;
+                }
+            }
+
+            uint64_t revealed = ~hidden_cells & ~flag_cells;
+            uint64_t mask = col_end - col_start == 64
+                                ? ~(uint64_t)0
+                                : ((uint64_t)1 << (col_end - col_start)) - 1;
+
+            grid.flags_placed += __builtin_popcountll(real_flags[idx]);
+            grid.mines_revealed += __builtin_popcountll(revealed & mines);
+            grid.safe_revealed +=
+                __builtin_popcountll(revealed & ~mines & mask);
+        }
+    }
+
+    return grid;
+}
+
+// The numbers of a grid that has its mines placed, counted from its mine plane
+// on the grid's scratch; generateGrid uses this under GRID_BITBOARD instead of
+// walking the neighbors of every mine.
+auto numberGrid(Grid *grid) -> void {
+    Arena *arena = grid->scratch;
+    auto mark = arena->mark();
+
+    Dims dims = grid->dims;
+    size_t stride = Bitboard::strideOf(dims);
+    Slice<uint64_t> mines = makePlane(arena, dims);
+    for (size_t row = 0; row < dims.height; ++row) {
+        for (size_t col = 0; col < dims.width; ++col) {
+            if ((*grid)[row][col].type == CellType::ct_mine) {
+                mines[row * stride + col / 64] |= (uint64_t)1 << (col % 64);
+            }
+        }
+    }
+
+    BitCounts numbers = countNeighbors(arena, dims, mines);
+
+    for (size_t row = 0; row < dims.height; ++row) {
+        for (size_t w = 0; w < stride; ++w) {
+            size_t idx = row * stride + w;
+            uint64_t mine_word = mines[idx];
+            uint64_t number_bits[4];
+            for (size_t k = 0; k < 4; ++k) {
+                number_bits[k] = numbers.bits[k][idx];
+            }
+
+            size_t col_start = w * 64;
+            size_t col_end =
+                col_start + 64 < dims.width ? col_start + 64 : dims.width;
+            Cell *cell = grid->cells.ptr + row * dims.width + col_start;
+
+            for (size_t col = col_start; col < col_end; ++col, ++cell) {
+                // mines keep the zero placeMines gave them
+                if ((mine_word & 1) == 0) {
+                    unsigned char number = lowCount(number_bits);
+                    cell->number = number;
+                    cell->eff_number = number;
+                }
+
+                mine_word >>= 1;
+                for (size_t k = 0; k < 4; ++k) {
+                    number_bits[k] >>= 1;
+                }
+            }
+        }
+    }
+}
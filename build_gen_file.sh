@@ -25,10 +25,18 @@ rm -f $OUT_FILE
 echo "#pragma once" >> $OUT_FILE
 echo "" >> $OUT_FILE
 echo 'static char const *plugin_objs[] = {' >> $OUT_FILE
-for F in patterns/*.pat ; do
-    F_ROOT="${F#patterns/}"
-    F_ROOT="${F_ROOT%.pat}"
+if [ -n "${FUSED:-}" ] ; then
+    echo "    "'"'"./pat_fused.${SO}"'"'"," >> $OUT_FILE
+elif [ -n "${LUT:-}" ] ; then
+    echo "    "'"'"./pat_lut.${SO}"'"'"," >> $OUT_FILE
+elif [ -n "${BIRD:-}" ] ; then
+    echo "    "'"'"./pat_bird.${SO}"'"'"," >> $OUT_FILE
+else
+    for F in patterns/*.pat ; do
+        F_ROOT="${F#patterns/}"
+        F_ROOT="${F_ROOT%.pat}"
 
-    echo "    "'"'"./pat_${F_ROOT}.${SO}"'"'"," >> $OUT_FILE
-done
+        echo "    "'"'"./pat_${F_ROOT}.${SO}"'"'"," >> $OUT_FILE
+    done
+fi
 echo '};' >> $OUT_FILE
@@ -8,6 +8,40 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+
+auto writeIncludes(FILE *out) -> void {
+    fprintf(out, "#include \"../grid.h\"\n");
+    fprintf(out, "#include \"../solver.h\"\n");
+    fprintf(out, "\n");
+    fprintf(out, "#include \"../arena.cc\"\n");
+    fprintf(out, "#include \"../dirutils.cc\"\n");
+    fprintf(out, "#include \"../strslice.cc\"\n");
+    fprintf(out, "\n");
+    fprintf(out, "#include <sys/types.h>\n");
+    fprintf(out, "\n");
+}
+
+auto writeRegistration(FILE *out, StrSlice out_fn) -> void {
+    fprintf(out, "static StrSlice rule_name = STR_SLICE(\"%.*s\");\n",
+            STR_ARGS(out_fn));
+    fprintf(out, "\n");
+    fprintf(out, "REGISTERER(regRule, arena, solver, state) {\n");
+    fprintf(out,
+            "    GridSolver::Rule rule = GridSolver::Rule::from(&%.*s, "
+            "rule_name);\n",
+            STR_ARGS(out_fn));
+    fprintf(out, "    rule.tier = RuleTier::rt_pattern;\n");
+    fprintf(out, "    solver->registerRule(arena, rule);\n");
+    fprintf(out, "}\n");
+    fprintf(out, "\n");
+    fprintf(out, "DEREGISTERER(deregRule, solver) {\n");
+    fprintf(out, "    solver->deregisterRule(rule_name);\n");
+    fprintf(out, "    return nullptr;\n");
+    fprintf(out, "}\n");
+    fprintf(out, "\n");
+    fprintf(out, "RulePlugin plugin{regRule, deregRule, nullptr, nullptr};\n");
+}
 
 auto writeStructDefinition(FILE *out, StrSlice out_fn, Dims dims) -> void {
     fprintf(out, "struct Pattern_%.*s {\n", STR_ARGS(out_fn));
@@ -63,36 +97,34 @@ auto writePatternMatchCell(FILE *out, PatternCell cell, Location loc) -> void {
     }
 }
 
-auto writeActionCell(FILE *out, Action action, Location loc) -> void {
+// cell is the expression for the Cell * the action is on
+auto writeActionCell(FILE *out, Action action, char const *cell) -> void {
     switch (action.action) {
     case act_flag: {
         fprintf(out,
-                "    if (pat.c_%zu_%zu->display_type == "
-                "CellDisplayType::cdt_hidden || pat.c_%zu_%zu->display_type == "
-                "CellDisplayType::cdt_maybe_flag) {\n",
-                loc.row, loc.col, loc.row, loc.col);
-        fprintf(out, "        api.flagCell(grid, pat.c_%zu_%zu);\n", loc.row,
-                loc.col);
+                "    if (%s->display_type == CellDisplayType::cdt_hidden || "
+                "%s->display_type == CellDisplayType::cdt_maybe_flag) {\n",
+                cell, cell);
+        fprintf(out, "        api.flagCell(grid, %s);\n", cell);
         fprintf(out, "        did_work = true;\n");
         fprintf(out, "    }\n");
         fprintf(out, "\n");
     } break;
     case act_execute: {
-        fprintf(
-            out,
-            "    if (pat.c_%zu_%zu->display_type == "
-            "CellDisplayType::cdt_maybe_flag || pat.c_%zu_%zu->display_type == "
-            "CellDisplayType::cdt_hidden) {\n",
-            loc.row, loc.col, loc.row, loc.col);
         fprintf(out,
-                "        // mark as hidden to remove possible maybe_flag\n");
+                "    if (%s->display_type == "
+                "CellDisplayType::cdt_maybe_flag || "
+                "%s->display_type == CellDisplayType::cdt_hidden) {\n",
+                cell, cell);
         fprintf(out,
-                "        pat.c_%zu_%zu->display_type = "
-                "CellDisplayType::cdt_hidden;\n",
-                loc.row, loc.col);
+                "        // unflag to remove possible maybe_flag\n");
         fprintf(out,
-                "        api.uncoverSelfAndNeighbors(grid, pat.c_%zu_%zu);\n",
-                loc.row, loc.col);
+                "        if (%s->display_type == "
+                "CellDisplayType::cdt_maybe_flag) {\n",
+                cell);
+        fprintf(out, "            api.unflagCell(grid, %s);\n", cell);
+        fprintf(out, "        }\n");
+        fprintf(out, "        api.uncoverSelfAndNeighbors(grid, %s);\n", cell);
         fprintf(out, "        did_work = true;\n");
         fprintf(out, "    }\n");
         fprintf(out, "\n");
@@ -100,6 +132,34 @@ auto writeActionCell(FILE *out, Action action, Location loc) -> void {
     }
 }
 
+// A cell whose neighbors all lie inside the pattern has to have exactly as
+// many hidden neighbors as the pattern has there, which is one byte to compare
+// and rejects most positions before any of the cells are looked at.
+auto writeHiddenCountChecks(FILE *out, Pattern pattern) -> void {
+    Dims dims = pattern.dims;
+    for (size_t r = 1; r + 1 < dims.height; ++r) {
+        for (size_t c = 1; c + 1 < dims.width; ++c) {
+            size_t hidden_count = 0;
+
+            auto neighbor_op = Op<Location>::empty();
+            auto neighbor_it = NeighborIterator{Location{r, c}, dims};
+            while ((neighbor_op = neighbor_it.next()).valid) {
+                Location loc = neighbor_op.get();
+                size_t idx = loc.row * dims.width + loc.col;
+                if (pattern.cells[idx].type == PatternCellType::pct_hidden) {
+                    ++hidden_count;
+                }
+            }
+
+            fprintf(out, "    if (pat.c_%zu_%zu->hidden_count != %zu) {\n", r,
+                    c, hidden_count);
+            fprintf(out, "        return false;\n");
+            fprintf(out, "    }\n");
+            fprintf(out, "\n");
+        }
+    }
+}
+
 auto writeCheckPatternFunction(FILE *out, StrSlice out_fn, Pattern pattern)
     -> void {
     fprintf(out,
@@ -110,6 +170,8 @@ auto writeCheckPatternFunction(FILE *out, StrSlice out_fn, Pattern pattern)
     fprintf(out, "    // check pattern match\n");
     fprintf(out, "\n");
 
+    writeHiddenCountChecks(out, pattern);
+
     Dims dims = pattern.dims;
     for (size_t r = 0; r < dims.height; ++r) {
         for (size_t c = 0; c < dims.width; ++c) {
@@ -124,7 +186,10 @@ auto writeCheckPatternFunction(FILE *out, StrSlice out_fn, Pattern pattern)
     fprintf(out, "\n");
 
     for (Action action : pattern.actions) {
-        writeActionCell(out, action, action.loc);
+        char cell[32];
+        snprintf(cell, sizeof(cell), "pat.c_%zu_%zu", action.loc.row,
+                 action.loc.col);
+        writeActionCell(out, action, cell);
     }
 
     fprintf(out, "    return did_work;\n");
@@ -237,84 +302,1392 @@ auto writeFunction_270r(FILE *out, StrSlice out_fn, Dims dims) -> void {
     writeFunctionGeneric<dimAdj90, locAdj270r>(out, out_fn, dims, 270, 'r');
 }
 
-auto writeBody(FILE *out, StrSlice out_fn, Pattern pattern) -> void {
-    fprintf(out, "#include \"../grid.h\"\n");
-    fprintf(out, "#include \"../solver.h\"\n");
-    fprintf(out, "\n");
-    fprintf(out, "#include \"../arena.cc\"\n");
-    fprintf(out, "#include \"../dirutils.cc\"\n");
-    fprintf(out, "#include \"../strslice.cc\"\n");
-    fprintf(out, "\n");
-    fprintf(out, "#include <sys/types.h>\n");
-    fprintf(out, "\n");
+typedef auto(WriteFunction)(FILE *out, StrSlice out_fn, Dims dims) -> void;
+
+struct Orientation {
+    DimsAdj *dims_adj;
+    LocAdj *loc_adj;
+    WriteFunction *write;
+    char const *name;
+};
+
+// in the order the rule tries them
+static Orientation const orientations[] = {
+    {&idDimAdj, &idLocAdj, &writeFunction_0n, "0n"},
+    {&dimAdj90, &locAdj90n, &writeFunction_90n, "90n"},
+    {&idDimAdj, &locAdj180n, &writeFunction_180n, "180n"},
+    {&dimAdj90, &locAdj270n, &writeFunction_270n, "270n"},
+    {&idDimAdj, &locAdj0r, &writeFunction_0r, "0r"},
+    {&dimAdj90, &locAdj90r, &writeFunction_90r, "90r"},
+    {&idDimAdj, &locAdj180r, &writeFunction_180r, "180r"},
+    {&dimAdj90, &locAdj270r, &writeFunction_270r, "270r"},
+};
+
+static constexpr size_t orientation_count =
+    sizeof(orientations) / sizeof(orientations[0]);
+
+// the pattern as it is laid out on the grid in the given orientation; walls
+// are not used here and are left as they were
+auto orientPattern(Arena *arena, Pattern pattern, Orientation orientation)
+    -> Pattern {
+    Dims dims = pattern.dims;
+
+    Pattern oriented = pattern;
+    oriented.dims = orientation.dims_adj(dims);
+    oriented.cells = Slice<PatternCell>{
+        arena->pushTN<PatternCell>(dims.area()), dims.area()};
+    oriented.actions = Slice<Action>{
+        arena->pushTN<Action>(pattern.actions.len), pattern.actions.len};
+
+    for (size_t r = 0; r < dims.height; ++r) {
+        for (size_t c = 0; c < dims.width; ++c) {
+            Location loc = orientation.loc_adj(dims, Location{r, c});
+            oriented.cells[loc.row * oriented.dims.width + loc.col] =
+                pattern.cells[r * dims.width + c];
+        }
+    }
+
+    for (size_t i = 0; i < pattern.actions.len; ++i) {
+        Action action = pattern.actions[i];
+        action.loc = orientation.loc_adj(dims, action.loc);
+        oriented.actions[i] = action;
+    }
+
+    return oriented;
+}
+
+auto samePatternCell(PatternCell a, PatternCell b) -> bool {
+    return a.type == b.type &&
+           (a.type != PatternCellType::pct_literal || a.number == b.number);
+}
+
+auto sameAction(Action a, Action b) -> bool {
+    return a.action == b.action && a.loc.row == b.loc.row &&
+           a.loc.col == b.loc.col && samePatternCell(a.pre_cond, b.pre_cond) &&
+           samePatternCell(a.post_cond, b.post_cond);
+}
+
+// whether two oriented patterns match the same cells and do the same thing,
+// in which case checking the second one can never do anything new
+auto samePattern(Pattern a, Pattern b) -> bool {
+    if (a.dims.width != b.dims.width || a.dims.height != b.dims.height ||
+        a.actions.len != b.actions.len) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.cells.len; ++i) {
+        if (!samePatternCell(a.cells[i], b.cells[i])) {
+            return false;
+        }
+    }
+
+    for (Action action : a.actions) {
+        bool found = false;
+        for (Action other : b.actions) {
+            found = found || sameAction(action, other);
+        }
+        if (!found) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// returns the number of orientations left out
+auto writeBody(Arena *arena, FILE *out, StrSlice out_fn, Pattern pattern)
+    -> size_t {
+    writeIncludes(out);
 
     Dims dims = pattern.dims;
 
     writeStructDefinition(out, out_fn, dims);
     writeCheckPatternFunction(out, out_fn, pattern);
 
-    writeFunction_0n(out, out_fn, dims);
-    writeFunction_90n(out, out_fn, dims);
-    writeFunction_180n(out, out_fn, dims);
-    writeFunction_270n(out, out_fn, dims);
+    // an orientation that lays the pattern out the same as an earlier one
+    // is left out
+    bool distinct[orientation_count];
+    size_t removed = 0;
+    {
+        auto mark = arena->mark();
 
-    writeFunction_0r(out, out_fn, dims);
-    writeFunction_90r(out, out_fn, dims);
-    writeFunction_180r(out, out_fn, dims);
-    writeFunction_270r(out, out_fn, dims);
+        Pattern oriented[orientation_count];
+        for (size_t i = 0; i < orientation_count; ++i) {
+            oriented[i] = orientPattern(arena, pattern, orientations[i]);
+
+            distinct[i] = true;
+            for (size_t j = 0; j < i; ++j) {
+                if (distinct[j] && samePattern(oriented[i], oriented[j])) {
+                    distinct[i] = false;
+                    ++removed;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < orientation_count; ++i) {
+        if (distinct[i]) {
+            orientations[i].write(out, out_fn, dims);
+        }
+    }
 
     fprintf(out,
             "auto %.*s(Grid *grid, GridApi api, size_t row, size_t col, void "
             "*) -> bool {\n",
             STR_ARGS(out_fn));
-    fprintf(out, "    bool did_work_0n = %.*s_0n(grid, api, row, col);\n",
-            STR_ARGS(out_fn));
-    fprintf(out, "    bool did_work_90n = %.*s_90n(grid, api, row, col);\n",
-            STR_ARGS(out_fn));
-    fprintf(out, "    bool did_work_180n = %.*s_180n(grid, api, row, col);\n",
-            STR_ARGS(out_fn));
-    fprintf(out, "    bool did_work_270n = %.*s_270n(grid, api, row, col);\n",
-            STR_ARGS(out_fn));
+    fprintf(out, "    bool did_work = false;\n");
+    for (size_t i = 0; i < orientation_count; ++i) {
+        if (distinct[i]) {
+            fprintf(out, "    if (%.*s_%s(grid, api, row, col)) {\n",
+                    STR_ARGS(out_fn), orientations[i].name);
+            fprintf(out, "        did_work = true;\n");
+            fprintf(out, "    }\n");
+        }
+    }
+    fprintf(out, "    return did_work;\n");
+    fprintf(out, "}\n");
     fprintf(out, "\n");
-    fprintf(out, "    bool did_work_0r = %.*s_0r(grid, api, row, col);\n",
-            STR_ARGS(out_fn));
-    fprintf(out, "    bool did_work_90r = %.*s_90r(grid, api, row, col);\n",
-            STR_ARGS(out_fn));
-    fprintf(out, "    bool did_work_180r = %.*s_180r(grid, api, row, col);\n",
-            STR_ARGS(out_fn));
-    fprintf(out, "    bool did_work_270r = %.*s_270r(grid, api, row, col);\n",
+    writeRegistration(out, out_fn);
+
+    return removed;
+}
+
+// fused {{{1
+// With --fused every pattern in every orientation (a variant) is compiled
+// into one rule. A variant is a set of tests on the cells at offsets from its
+// anchor, the top-left of its box, and the rule walks a decision tree over
+// those tests: each node tests one property of one cell, the one the most
+// remaining variants care about, and branches on its value. A cell is copied
+// into a local the first time a path needs it, so it is read at most once per
+// anchor whatever the number of variants. Matches are only noted while
+// walking the tree, the actions run after it, all on the grid as it was.
+// A variant that lays out the same as an earlier one, of the same pattern or
+// not, is left out.
+
+static char const *FUSED_OUT_NAME = "generated/pat_fused.cc";
+
+enum FeatureKind {
+    fk_class,        // cellClass of the cell
+    fk_hidden_count, // hidden_count of the cell
+};
+
+struct Feature {
+    size_t offset; // into Fused::offsets
+    FeatureKind kind;
+};
+
+// the values of cellClass, see writeCellClass
+static constexpr unsigned class_hidden = 0;
+static constexpr unsigned class_flag = 1;
+static constexpr unsigned class_number = 4; // + eff_number, up to 9
+static constexpr unsigned class_outside = 14;
+static constexpr unsigned class_values = 15;
+
+// hidden counts go up to 8, a cell outside the grid gets 9
+static constexpr unsigned hidden_outside = 9;
+static constexpr unsigned hidden_values = 10;
+
+struct FeatureTest {
+    size_t feature;
+    unsigned allowed; // a bit per value
+};
+
+struct Variant {
+    StrSlice name;
+    Pattern *pattern; // oriented, so actions are at offsets from the anchor
+    Slice<FeatureTest> tests;
+};
+
+struct Fused {
+    Arena *arena;
+    Slice<Location> offsets;
+    Slice<Feature> features;
+    Slice<Variant> variants;
+    size_t cap; // of each of the above
+};
+
+auto makeFused(Arena *arena, size_t cap) -> Fused {
+    Fused fused{arena};
+    fused.offsets = Slice<Location>{arena->pushTN<Location>(cap), 0};
+    fused.features = Slice<Feature>{arena->pushTN<Feature>(cap), 0};
+    fused.variants = Slice<Variant>{arena->pushTN<Variant>(cap), 0};
+    fused.cap = cap;
+    return fused;
+}
+
+auto featureIndex(Fused *fused, Location loc, FeatureKind kind) -> size_t {
+    size_t offset = 0;
+    while (offset < fused->offsets.len &&
+           !(fused->offsets[offset].row == loc.row &&
+             fused->offsets[offset].col == loc.col)) {
+        ++offset;
+    }
+    if (offset == fused->offsets.len) {
+        assert(offset < fused->cap && "Too many offsets");
+        fused->offsets.ptr[fused->offsets.len++] = loc;
+    }
+
+    for (size_t idx = 0; idx < fused->features.len; ++idx) {
+        Feature feature = fused->features[idx];
+        if (feature.offset == offset && feature.kind == kind) {
+            return idx;
+        }
+    }
+
+    assert(fused->features.len < fused->cap && "Too many features");
+    fused->features.ptr[fused->features.len] = Feature{offset, kind};
+    return fused->features.len++;
+}
+
+auto allowedValues(PatternCell cell) -> unsigned {
+    switch (cell.type) {
+    case pct_hidden: {
+        return 1u << class_hidden;
+    } break;
+    case pct_number: {
+        // a flag counts as a number, as in writePatternMatchCell
+        unsigned numbers = ((1u << 10) - 1) << class_number;
+        return numbers | (1u << class_flag);
+    } break;
+    case pct_literal: {
+        return 1u << (class_number + cell.number);
+    } break;
+    case pct_flag:
+    case pct_execute: {
+        assert(0 && "Bad pattern");
+    } break;
+    }
+
+    assert(0 && "Unreachable");
+}
+
+// pattern is already oriented, see orientPattern
+auto addVariant(Fused *fused, Pattern pattern, StrSlice pattern_name,
+                char const *orientation_name) -> void {
+    Arena *arena = fused->arena;
+    Dims dims = pattern.dims;
+    size_t cell_count = dims.area();
+
+    Variant variant{};
+    variant.pattern = arena->pushT(pattern);
+
+    size_t name_len = pattern_name.len + 6;
+    variant.name =
+        sliceNPrintf(arena->pushTN<char>(name_len), name_len, "%.*s_%s",
+                     STR_ARGS(pattern_name), orientation_name);
+
+    // every cell and at most every cell's hidden count
+    variant.tests = Slice<FeatureTest>{
+        arena->pushTN<FeatureTest>(2 * cell_count), 0};
+
+    for (size_t r = 0; r < dims.height; ++r) {
+        for (size_t c = 0; c < dims.width; ++c) {
+            PatternCell cell = pattern.cells[r * dims.width + c];
+
+            size_t feature =
+                featureIndex(fused, Location{r, c}, FeatureKind::fk_class);
+            variant.tests.ptr[variant.tests.len++] =
+                FeatureTest{feature, allowedValues(cell)};
+        }
+    }
+
+    // the same checks as writeHiddenCountChecks
+    for (size_t r = 1; r + 1 < dims.height; ++r) {
+        for (size_t c = 1; c + 1 < dims.width; ++c) {
+            size_t hidden_count = 0;
+
+            auto neighbor_op = Op<Location>::empty();
+            auto neighbor_it = NeighborIterator{Location{r, c}, dims};
+            while ((neighbor_op = neighbor_it.next()).valid) {
+                Location loc = neighbor_op.get();
+                size_t idx = loc.row * dims.width + loc.col;
+                if (pattern.cells[idx].type == PatternCellType::pct_hidden) {
+                    ++hidden_count;
+                }
+            }
+
+            size_t feature = featureIndex(fused, Location{r, c},
+                                          FeatureKind::fk_hidden_count);
+            variant.tests.ptr[variant.tests.len++] =
+                FeatureTest{feature, 1u << hidden_count};
+        }
+    }
+
+    assert(fused->variants.len < fused->cap && "Too many variants");
+    fused->variants.ptr[fused->variants.len++] = variant;
+}
+
+// whether some variant already lays out the same pattern, possibly another
+// pattern file's in some orientation
+auto hasVariant(Fused *fused, Pattern pattern) -> bool {
+    for (Variant variant : fused->variants) {
+        if (samePattern(*variant.pattern, pattern)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// every value when the variant does not test the feature
+auto allowedBy(Variant variant, size_t feature) -> unsigned {
+    for (FeatureTest test : variant.tests) {
+        if (test.feature == feature) {
+            return test.allowed;
+        }
+    }
+    return ~0u;
+}
+
+auto writeIndent(FILE *out, size_t depth) -> void {
+    fprintf(out, "%*s", (int)(4 * depth), "");
+}
+
+auto writeCellClass(FILE *out) -> void {
+    fprintf(out, "static inline auto cellClass(Cell cell) -> unsigned {\n");
+    fprintf(out, "    switch (cell.display_type) {\n");
+    fprintf(out, "    case CellDisplayType::cdt_hidden:\n");
+    fprintf(out, "        return 0;\n");
+    fprintf(out, "    case CellDisplayType::cdt_flag:\n");
+    fprintf(out, "        return 1;\n");
+    fprintf(out, "    case CellDisplayType::cdt_maybe_flag:\n");
+    fprintf(out, "        return 2;\n");
+    fprintf(out, "    case CellDisplayType::cdt_value:\n");
+    fprintf(out, "        break;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "\n");
+    fprintf(out, "    if (cell.type == CellType::ct_mine) {\n");
+    fprintf(out, "        return 3;\n");
+    fprintf(out, "    }\n");
+    fprintf(out,
+            "    return 4 + (cell.eff_number < 9 ? cell.eff_number : 9);\n");
+    fprintf(out, "}\n");
+    fprintf(out, "\n");
+}
+
+auto writeLoadCell(FILE *out, Location loc, size_t depth) -> void {
+    if (loc.row == 0 && loc.col == 0) {
+        writeIndent(out, depth);
+        fprintf(out, "Cell cell_0_0 = (*grid)[row][col];\n");
+        return;
+    }
+
+    writeIndent(out, depth);
+    fprintf(out,
+            "bool in_%zu_%zu = row + %zu < grid->dims.height && "
+            "col + %zu < grid->dims.width;\n",
+            loc.row, loc.col, loc.row, loc.col);
+    writeIndent(out, depth);
+    fprintf(out,
+            "Cell cell_%zu_%zu = in_%zu_%zu ? (*grid)[row + %zu][col + %zu] "
+            ": Cell{};\n",
+            loc.row, loc.col, loc.row, loc.col, loc.row, loc.col);
+}
+
+auto writeFeatureValue(FILE *out, Location loc, FeatureKind kind) -> void {
+    bool anchor = loc.row == 0 && loc.col == 0;
+
+    switch (kind) {
+    case fk_class: {
+        if (anchor) {
+            fprintf(out, "cellClass(cell_0_0)");
+        } else {
+            fprintf(out, "in_%zu_%zu ? cellClass(cell_%zu_%zu) : %u", loc.row,
+                    loc.col, loc.row, loc.col, class_outside);
+        }
+    } break;
+    case fk_hidden_count: {
+        if (anchor) {
+            fprintf(out, "cell_0_0.hidden_count");
+        } else {
+            fprintf(out, "in_%zu_%zu ? cell_%zu_%zu.hidden_count : %u",
+                    loc.row, loc.col, loc.row, loc.col, hidden_outside);
+        }
+    } break;
+    }
+}
+
+// live are the variants whose tests passed so far, tested and loaded say
+// which features and cells this path has already been through
+auto writeNode(FILE *out, Fused *fused, Slice<size_t> live,
+               Slice<bool> tested, Slice<bool> loaded, size_t depth) -> void {
+    Arena *arena = fused->arena;
+    auto mark = arena->mark();
+
+    // the variants with nothing left to test have matched
+    Slice<size_t> open{arena->pushTN<size_t>(live.len), 0};
+    for (size_t v : live) {
+        bool done = true;
+        for (FeatureTest test : fused->variants[v].tests) {
+            done = done && tested[test.feature];
+        }
+
+        if (done) {
+            writeIndent(out, depth);
+            fprintf(out, "matched[%zu] = true; // %.*s\n", v,
+                    STR_ARGS(fused->variants[v].name));
+        } else {
+            open.ptr[open.len++] = v;
+        }
+    }
+    if (open.len == 0) {
+        return;
+    }
+
+    size_t best = 0;
+    size_t best_count = 0;
+    for (size_t f = 0; f < fused->features.len; ++f) {
+        if (tested[f]) {
+            continue;
+        }
+
+        size_t count = 0;
+        for (size_t v : open) {
+            count += allowedBy(fused->variants[v], f) != ~0u;
+        }
+        if (count > best_count) {
+            best = f;
+            best_count = count;
+        }
+    }
+    assert(best_count > 0 && "No feature left to test");
+
+    Feature feature = fused->features[best];
+    Location loc = fused->offsets[feature.offset];
+
+    Slice<bool> next_tested{arena->pushTN<bool>(tested.len), tested.len};
+    Slice<bool> next_loaded{arena->pushTN<bool>(loaded.len), loaded.len};
+    for (size_t i = 0; i < tested.len; ++i) {
+        next_tested[i] = tested[i];
+    }
+    for (size_t i = 0; i < loaded.len; ++i) {
+        next_loaded[i] = loaded[i];
+    }
+    next_tested[best] = true;
+
+    if (!loaded[feature.offset]) {
+        writeLoadCell(out, loc, depth);
+        next_loaded[feature.offset] = true;
+    }
+
+    writeIndent(out, depth);
+    fprintf(out, "switch (");
+    writeFeatureValue(out, loc, feature.kind);
+    fprintf(out, ") {\n");
+
+    unsigned values =
+        feature.kind == FeatureKind::fk_class ? class_values : hidden_values;
+
+    // values that leave the same variants share a branch
+    unsigned done = 0;
+    for (unsigned value = 0; value < values; ++value) {
+        if (done & (1u << value)) {
+            continue;
+        }
+
+        Slice<size_t> branch{arena->pushTN<size_t>(open.len), 0};
+        for (size_t v : open) {
+            if (allowedBy(fused->variants[v], best) & (1u << value)) {
+                branch.ptr[branch.len++] = v;
+            }
+        }
+        if (branch.len == 0) {
+            continue;
+        }
+
+        unsigned labels = 0;
+        for (unsigned other = value; other < values; ++other) {
+            bool same = true;
+            size_t i = 0;
+            for (size_t v : open) {
+                bool allowed = allowedBy(fused->variants[v], best) &
+                               (1u << other);
+                if (allowed) {
+                    same = same && i < branch.len && branch[i] == v;
+                    ++i;
+                }
+            }
+            if (same && i == branch.len) {
+                labels |= 1u << other;
+            }
+        }
+        done |= labels;
+
+        for (unsigned other = value; labels != 0; ++other) {
+            if (labels & (1u << other)) {
+                labels &= ~(1u << other);
+                writeIndent(out, depth);
+                fprintf(out, "case %u:%s\n", other, labels ? "" : " {");
+            }
+        }
+        writeNode(out, fused, branch, next_tested, next_loaded, depth + 1);
+        writeIndent(out, depth);
+        fprintf(out, "} break;\n");
+    }
+
+    writeIndent(out, depth);
+    fprintf(out, "default:\n");
+    writeIndent(out, depth);
+    fprintf(out, "    break;\n");
+    writeIndent(out, depth);
+    fprintf(out, "}\n");
+}
+
+auto writeFusedActions(FILE *out, Fused *fused, size_t v) -> void {
+    Variant variant = fused->variants[v];
+
+    fprintf(out, "// %.*s\n", STR_ARGS(variant.name));
+    fprintf(out,
+            "static auto act_%zu(Grid *grid, GridApi api, size_t row, "
+            "size_t col) -> bool {\n",
+            v);
+    fprintf(out, "    bool did_work = false;\n");
+    fprintf(out, "\n");
+
+    for (Action action : variant.pattern->actions) {
+        char cell[32];
+        snprintf(cell, sizeof(cell), "cell_%zu_%zu", action.loc.row,
+                 action.loc.col);
+
+        fprintf(out, "    Cell *%s = &(*grid)[row + %zu][col + %zu];\n", cell,
+                action.loc.row, action.loc.col);
+        writeActionCell(out, action, cell);
+    }
+
+    fprintf(out, "    return did_work;\n");
+    fprintf(out, "}\n");
+    fprintf(out, "\n");
+}
+
+// the end of the rule, once matched is filled in
+auto writeRunMatched(FILE *out, Fused *fused) -> void {
+    fprintf(out, "\n");
+    fprintf(out, "    bool did_work = false;\n");
+    for (size_t v = 0; v < fused->variants.len; ++v) {
+        fprintf(out,
+                "    if (matched[%zu] && act_%zu(grid, api, row, col)) {\n", v,
+                v);
+        fprintf(out, "        did_work = true;\n");
+        fprintf(out, "    }\n");
+    }
+    fprintf(out, "    return did_work;\n");
+    fprintf(out, "}\n");
+    fprintf(out, "\n");
+}
+
+auto writeFusedBody(FILE *out, StrSlice out_fn, Fused *fused) -> void {
+    writeIncludes(out);
+
+    writeCellClass(out);
+    for (size_t v = 0; v < fused->variants.len; ++v) {
+        writeFusedActions(out, fused, v);
+    }
+
+    fprintf(out,
+            "auto %.*s(Grid *grid, GridApi api, size_t row, size_t col, void "
+            "*) -> bool {\n",
             STR_ARGS(out_fn));
+    fprintf(out, "    bool matched[%zu] = {};\n", fused->variants.len);
     fprintf(out, "\n");
-    fprintf(out, "    return did_work_0n || did_work_180n || did_work_90n || "
-                 "did_work_270n ||\n");
-    fprintf(out, "           did_work_0r || did_work_180r || did_work_90r || "
-                 "did_work_270r;\n");
+
+    {
+        Arena *arena = fused->arena;
+        auto mark = arena->mark();
+
+        size_t variant_count = fused->variants.len;
+        Slice<size_t> live{arena->pushTN<size_t>(variant_count),
+                           variant_count};
+        for (size_t v = 0; v < variant_count; ++v) {
+            live[v] = v;
+        }
+        Slice<bool> tested{arena->pushTN<bool>(fused->features.len, false),
+                           fused->features.len};
+        Slice<bool> loaded{arena->pushTN<bool>(fused->offsets.len, false),
+                           fused->offsets.len};
+
+        writeNode(out, fused, live, tested, loaded, 1);
+    }
+
+    writeRunMatched(out, fused);
+    writeRegistration(out, out_fn);
+}
+// }}}1
+
+// lut {{{1
+// With --lut the same variants are found with a table lookup instead of the
+// decision tree. Every cell of the window at the anchor is reduced to two
+// bits, whether it is hidden, a number (or flag) or neither, and the window
+// to one key. A variant fixes those bits for every cell of its box, so the key
+// masked to the box is the same for every position the variant can match at,
+// and is looked up in a hash table built here. Literals are the only tests
+// left for what it finds. The hidden count checks are implied: a cell with
+// all its neighbors in the box has every one of them tested.
+
+static char const *LUT_OUT_NAME = "generated/pat_lut.cc";
+
+static constexpr size_t lut_window = 4; // the window is 4x4, 32 bits
+
+// the values of cellBits
+static constexpr uint32_t bits_hidden = 1;
+static constexpr uint32_t bits_number = 2;
+
+struct LutEntry {
+    uint64_t key; // the box index above the masked window
+    size_t first; // into the candidates
+    size_t count;
+};
+
+auto lutHash(uint64_t key, unsigned table_bits) -> size_t {
+    return (key * 0x9e3779b97f4a7c15ull) >> (64 - table_bits);
+}
+
+auto windowShift(size_t r, size_t c) -> unsigned {
+    return 2 * (r * lut_window + c);
+}
+
+auto boxMask(Dims dims) -> uint32_t {
+    uint32_t mask = 0;
+    for (size_t r = 0; r < dims.height; ++r) {
+        for (size_t c = 0; c < dims.width; ++c) {
+            mask |= 3u << windowShift(r, c);
+        }
+    }
+    return mask;
+}
+
+auto variantKey(Pattern *pattern, size_t box) -> uint64_t {
+    Dims dims = pattern->dims;
+
+    uint32_t window = 0;
+    for (size_t r = 0; r < dims.height; ++r) {
+        for (size_t c = 0; c < dims.width; ++c) {
+            PatternCell cell = pattern->cells[r * dims.width + c];
+            uint32_t bits = cell.type == PatternCellType::pct_hidden
+                                ? bits_hidden
+                                : bits_number;
+            window |= bits << windowShift(r, c);
+        }
+    }
+
+    return (uint64_t)box << 32 | window;
+}
+
+auto writeCellBits(FILE *out) -> void {
+    fprintf(out,
+            "static inline auto cellBits(Grid *grid, size_t row, size_t col) "
+            "-> uint32_t {\n");
+    fprintf(out,
+            "    if (row >= grid->dims.height || col >= grid->dims.width) {\n");
+    fprintf(out, "        return 0;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "\n");
+    fprintf(out, "    Cell cell = (*grid)[row][col];\n");
+    fprintf(out, "    switch (cell.display_type) {\n");
+    fprintf(out, "    case CellDisplayType::cdt_hidden:\n");
+    fprintf(out, "        return %u;\n", bits_hidden);
+    fprintf(out, "    case CellDisplayType::cdt_flag:\n");
+    fprintf(out, "        return %u;\n", bits_number);
+    fprintf(out, "    case CellDisplayType::cdt_maybe_flag:\n");
+    fprintf(out, "        return 0;\n");
+    fprintf(out, "    case CellDisplayType::cdt_value:\n");
+    fprintf(out, "        break;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "\n");
+    fprintf(out, "    return cell.type == CellType::ct_number ? %u : 0;\n",
+            bits_number);
     fprintf(out, "}\n");
     fprintf(out, "\n");
-    fprintf(out, "static StrSlice rule_name = STR_SLICE(\"%.*s\");\n",
+}
+
+// the cells the key can't tell apart from any other number
+auto writeLiteralChecks(FILE *out, Fused *fused, size_t v) -> void {
+    Pattern *pattern = fused->variants[v].pattern;
+    Dims dims = pattern->dims;
+
+    fprintf(out,
+            "static auto lit_%zu(Grid *grid, size_t row, size_t col) -> bool "
+            "{\n",
+            v);
+    for (size_t r = 0; r < dims.height; ++r) {
+        for (size_t c = 0; c < dims.width; ++c) {
+            PatternCell cell = pattern->cells[r * dims.width + c];
+            if (cell.type != PatternCellType::pct_literal) {
+                continue;
+            }
+
+            fprintf(out,
+                    "    Cell cell_%zu_%zu = (*grid)[row + %zu][col + %zu];\n",
+                    r, c, r, c);
+            fprintf(out,
+                    "    if (cell_%zu_%zu.display_type != "
+                    "CellDisplayType::cdt_value || cell_%zu_%zu.type != "
+                    "CellType::ct_number || cell_%zu_%zu.eff_number != %d) {\n",
+                    r, c, r, c, r, c, cell.number);
+            fprintf(out, "        return false;\n");
+            fprintf(out, "    }\n");
+        }
+    }
+    fprintf(out, "    return true;\n");
+    fprintf(out, "}\n");
+    fprintf(out, "\n");
+}
+
+auto writeLutBody(FILE *out, StrSlice out_fn, Fused *fused) -> void {
+    Arena *arena = fused->arena;
+    auto mark = arena->mark();
+
+    size_t variant_count = fused->variants.len;
+
+    // the distinct boxes, every variant's key is masked to its own
+    Slice<Dims> boxes{arena->pushTN<Dims>(variant_count), 0};
+    Slice<uint64_t> keys{arena->pushTN<uint64_t>(variant_count),
+                         variant_count};
+    for (size_t v = 0; v < variant_count; ++v) {
+        Dims dims = fused->variants[v].pattern->dims;
+        if (dims.width > lut_window || dims.height > lut_window) {
+            fprintf(stderr, "Pattern %.*s does not fit in a %zux%zu window\n",
+                    STR_ARGS(fused->variants[v].name), lut_window,
+                    lut_window);
+            EXIT(1);
+        }
+
+        size_t box = 0;
+        while (box < boxes.len && !(boxes[box].width == dims.width &&
+                                    boxes[box].height == dims.height)) {
+            ++box;
+        }
+        if (box == boxes.len) {
+            boxes.ptr[boxes.len++] = dims;
+        }
+
+        keys[v] = variantKey(fused->variants[v].pattern, box);
+    }
+
+    // an entry per distinct key, with the variants that have it
+    Slice<LutEntry> entries{arena->pushTN<LutEntry>(variant_count), 0};
+    Slice<size_t> candidates{arena->pushTN<size_t>(variant_count), 0};
+    for (size_t v = 0; v < variant_count; ++v) {
+        bool seen = false;
+        for (LutEntry entry : entries) {
+            seen = seen || entry.key == keys[v];
+        }
+        if (seen) {
+            continue;
+        }
+
+        LutEntry entry{keys[v], candidates.len, 0};
+        for (size_t other = v; other < variant_count; ++other) {
+            if (keys[other] == keys[v]) {
+                candidates.ptr[candidates.len++] = other;
+                ++entry.count;
+            }
+        }
+        entries.ptr[entries.len++] = entry;
+    }
+
+    // at most half full, so a probe ends at an empty slot soon
+    unsigned table_bits = 1;
+    while (((size_t)1 << table_bits) < 2 * entries.len) {
+        ++table_bits;
+    }
+    size_t table_size = (size_t)1 << table_bits;
+
+    Slice<LutEntry> table{arena->pushTN<LutEntry>(table_size), table_size};
+    for (LutEntry entry : entries) {
+        size_t slot = lutHash(entry.key, table_bits);
+        while (table[slot].count != 0) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        table[slot] = entry;
+    }
+
+    writeIncludes(out);
+    fprintf(out, "#include <stdint.h>\n");
+    fprintf(out, "\n");
+
+    writeCellBits(out);
+    for (size_t v = 0; v < variant_count; ++v) {
+        writeLiteralChecks(out, fused, v);
+        writeFusedActions(out, fused, v);
+    }
+
+    fprintf(out, "typedef auto(LiteralCheck)(Grid *grid, size_t row, size_t "
+                 "col) -> bool;\n");
+    fprintf(out, "\n");
+    fprintf(out, "static LiteralCheck *const literal_checks[] = {\n");
+    for (size_t v = 0; v < variant_count; ++v) {
+        fprintf(out, "    &lit_%zu, // %.*s\n", v,
+                STR_ARGS(fused->variants[v].name));
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "\n");
+
+    fprintf(out, "static uint32_t const box_masks[] = {\n");
+    for (Dims box : boxes) {
+        fprintf(out, "    0x%08x, // %zux%zu\n", boxMask(box), box.height,
+                box.width);
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "\n");
+
+    fprintf(out, "struct LutSlot {\n");
+    fprintf(out, "    uint64_t key;\n");
+    fprintf(out, "    unsigned short first;\n");
+    fprintf(out, "    unsigned short count; // 0 when empty\n");
+    fprintf(out, "};\n");
+    fprintf(out, "\n");
+    fprintf(out, "static LutSlot const lut[%zu] = {\n", table_size);
+    for (LutEntry entry : table) {
+        fprintf(out, "    {0x%011llxull, %zu, %zu},\n",
+                (unsigned long long)entry.key, entry.first, entry.count);
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "\n");
+    fprintf(out, "static unsigned short const lut_candidates[] = {\n");
+    for (size_t v : candidates) {
+        fprintf(out, "    %zu,\n", v);
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "\n");
+
+    fprintf(out,
+            "auto %.*s(Grid *grid, GridApi api, size_t row, size_t col, void "
+            "*) -> bool {\n",
             STR_ARGS(out_fn));
+    fprintf(out, "    uint32_t window = 0;\n");
+    fprintf(out, "    for (size_t r = 0; r < %zu; ++r) {\n", lut_window);
+    fprintf(out, "        for (size_t c = 0; c < %zu; ++c) {\n", lut_window);
+    fprintf(out, "            uint32_t bits = cellBits(grid, row + r, col + "
+                 "c);\n");
+    fprintf(out, "            window |= bits << (2 * (r * %zu + c));\n",
+            lut_window);
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n");
     fprintf(out, "\n");
-    fprintf(out, "REGISTERER(regRule, arena, solver) {\n");
+    fprintf(out, "    bool matched[%zu] = {};\n", variant_count);
+    fprintf(out, "    for (size_t box = 0; box < %zu; ++box) {\n", boxes.len);
+    fprintf(out, "        uint64_t key = (uint64_t)box << 32 | (window & "
+                 "box_masks[box]);\n");
     fprintf(out,
-            "    solver->registerRule(arena, GridSolver::Rule::from(&%.*s, "
-            "rule_name));\n",
+            "        size_t slot = (key * 0x9e3779b97f4a7c15ull) >> %u;\n",
+            64 - table_bits);
+    fprintf(out, "        while (lut[slot].count != 0 && lut[slot].key != "
+                 "key) {\n");
+    fprintf(out, "            slot = (slot + 1) & %zu;\n", table_size - 1);
+    fprintf(out, "        }\n");
+    fprintf(out, "\n");
+    fprintf(out, "        LutSlot entry = lut[slot];\n");
+    fprintf(out, "        for (size_t i = entry.first; i < entry.first + "
+                 "entry.count; ++i) {\n");
+    fprintf(out, "            size_t v = lut_candidates[i];\n");
+    fprintf(out, "            matched[v] = literal_checks[v](grid, row, "
+                 "col);\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n");
+    writeRunMatched(out, fused);
+
+    writeRegistration(out, out_fn);
+}
+// }}}1
+
+// bird {{{1
+// With --bird the variants become the tables of a Baker-Bird matcher, see
+// bakerbird.cc. A pattern cell stands for a set of cell classes (a number is
+// any number or a flag), so both automata are Aho-Corasick over strings of
+// sets, built as DFAs whose states are the sets of string positions that can
+// have been matched up to there. More than one pattern row can end at a cell,
+// so what the column automaton reads is the set of rows that do, numbered.
+
+static char const *BIRD_OUT_NAME = "generated/pat_bird.cc";
+
+// state numbers have to fit the tables' shorts
+static constexpr size_t dfa_max_states = 65535;
+
+// String i is made of the positions [starts[i], starts[i + 1]), each a set of
+// the symbols it accepts.
+struct DfaStrings {
+    size_t symbol_count;
+    Slice<size_t> starts; // one more than there are strings
+    Slice<uint64_t> accepts; // symbolWords per position
+};
+
+struct Dfa {
+    size_t state_count;
+    Slice<unsigned short> next; // [state][symbol]
+    Slice<uint64_t> ends;       // stringWords per state, the strings ending
+};
+
+auto wordsFor(size_t bits) -> size_t { return (bits + 63) / 64; }
+
+auto hasBit(uint64_t const *words, size_t bit) -> bool {
+    return (words[bit / 64] >> (bit % 64)) & 1;
+}
+
+auto setBit(uint64_t *words, size_t bit) -> void {
+    words[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+auto hashWords(uint64_t const *words, size_t count) -> uint64_t {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < count; ++i) {
+        hash = (hash ^ words[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// what buildDfa needs from its arena, at most
+auto dfaArenaSize(DfaStrings strings) -> size_t {
+    size_t position_count = strings.starts[strings.starts.len - 1];
+    size_t string_count = strings.starts.len - 1;
+
+    size_t per_state = 8 * wordsFor(position_count) +
+                       2 * strings.symbol_count + 8 * wordsFor(string_count) +
+                       2 * sizeof(size_t);
+    return (dfa_max_states + 1) * per_state + 8 * position_count + 4096;
+}
+
+auto buildDfa(Arena *arena, DfaStrings strings) -> Dfa {
+    size_t position_count = strings.starts[strings.starts.len - 1];
+    size_t string_count = strings.starts.len - 1;
+    size_t symbol_words = wordsFor(strings.symbol_count);
+    size_t words = wordsFor(position_count);
+
+    // a position can always be matched when it starts its string, otherwise
+    // only right after the one before it was
+    Slice<bool> first{arena->pushTN<bool>(position_count, false),
+                      position_count};
+    for (size_t i = 0; i < string_count; ++i) {
+        first[strings.starts[i]] = true;
+    }
+
+    // one more set than there can be states, for the one being built
+    size_t set_words = (dfa_max_states + 1) * words;
+    Slice<uint64_t> sets{arena->pushTN<uint64_t>(set_words, 0), set_words};
+    size_t table_size = 2 * dfa_max_states;
+    Slice<size_t> table{arena->pushTN<size_t>(table_size, 0), table_size};
+
+    Dfa dfa{};
+    dfa.next = Slice<unsigned short>{
+        arena->pushTN<unsigned short>(dfa_max_states * strings.symbol_count),
+        dfa_max_states * strings.symbol_count};
+
+    // state 0 is the empty set, where nothing has been matched yet
+    dfa.state_count = 1;
+    table[hashWords(&sets[0], words) % table_size] = 1;
+
+    for (size_t state = 0; state < dfa.state_count; ++state) {
+        for (size_t symbol = 0; symbol < strings.symbol_count; ++symbol) {
+            uint64_t *set = &sets.ptr[dfa.state_count * words];
+            for (size_t w = 0; w < words; ++w) {
+                set[w] = 0;
+            }
+
+            uint64_t const *from = &sets[state * words];
+            for (size_t p = 0; p < position_count; ++p) {
+                if (hasBit(&strings.accepts[p * symbol_words], symbol) &&
+                    (first[p] || hasBit(from, p - 1))) {
+                    setBit(set, p);
+                }
+            }
+
+            // the table holds state + 1, 0 being empty
+            size_t slot = hashWords(set, words) % table_size;
+            while (table[slot] != 0) {
+                uint64_t const *other = &sets[(table[slot] - 1) * words];
+                bool same = true;
+                for (size_t w = 0; w < words; ++w) {
+                    same = same && other[w] == set[w];
+                }
+                if (same) {
+                    break;
+                }
+                slot = (slot + 1) % table_size;
+            }
+
+            if (table[slot] == 0) {
+                if (dfa.state_count == dfa_max_states) {
+                    fprintf(stderr,
+                            "Pattern automaton needs more than %zu states\n",
+                            dfa_max_states);
+                    EXIT(1);
+                }
+                table[slot] = ++dfa.state_count;
+            }
+
+            dfa.next[state * strings.symbol_count + symbol] =
+                (unsigned short)(table[slot] - 1);
+        }
+    }
+
+    size_t string_words = wordsFor(string_count);
+    dfa.ends = Slice<uint64_t>{
+        arena->pushTN<uint64_t>(dfa.state_count * string_words, 0),
+        dfa.state_count * string_words};
+    for (size_t state = 0; state < dfa.state_count; ++state) {
+        for (size_t i = 0; i < string_count; ++i) {
+            if (hasBit(&sets[state * words], strings.starts[i + 1] - 1)) {
+                setBit(&dfa.ends[state * string_words], i);
+            }
+        }
+    }
+
+    return dfa;
+}
+
+auto sameRow(Pattern *a, size_t a_row, Pattern *b, size_t b_row) -> bool {
+    if (a->dims.width != b->dims.width) {
+        return false;
+    }
+
+    for (size_t c = 0; c < a->dims.width; ++c) {
+        if (!samePatternCell(a->cells[a_row * a->dims.width + c],
+                             b->cells[b_row * b->dims.width + c])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto writeShorts(FILE *out, char const *name, Slice<unsigned short> values)
+    -> void {
+    fprintf(out, "static unsigned short const %s[] = {", name);
+    for (size_t i = 0; i < values.len; ++i) {
+        fprintf(out, "%s%u,", i % 12 == 0 ? "\n    " : " ", values[i]);
+    }
+    fprintf(out, "\n};\n");
+    fprintf(out, "\n");
+}
+
+auto writeBirdBody(FILE *out, StrSlice out_fn, Fused *fused) -> void {
+    Arena *arena = fused->arena;
+    auto mark = arena->mark();
+
+    size_t variant_count = fused->variants.len;
+
+    // the distinct pattern rows, and which one each variant row is
+    struct RowRef {
+        Pattern *pattern;
+        size_t row;
+    };
+    size_t row_cap = 0;
+    for (Variant variant : fused->variants) {
+        row_cap += variant.pattern->dims.height;
+    }
+    Slice<RowRef> rows{arena->pushTN<RowRef>(row_cap), 0};
+    Slice<size_t> row_ids{arena->pushTN<size_t>(row_cap), row_cap};
+
+    size_t position_count = 0;
+    size_t ref = 0;
+    for (Variant variant : fused->variants) {
+        for (size_t r = 0; r < variant.pattern->dims.height; ++r) {
+            size_t id = 0;
+            while (id < rows.len &&
+                   !sameRow(rows[id].pattern, rows[id].row, variant.pattern,
+                            r)) {
+                ++id;
+            }
+            if (id == rows.len) {
+                rows.ptr[rows.len++] = RowRef{variant.pattern, r};
+                position_count += variant.pattern->dims.width;
+            }
+            row_ids[ref++] = id;
+        }
+    }
+
+    DfaStrings row_strings{class_values};
+    row_strings.starts = Slice<size_t>{arena->pushTN<size_t>(rows.len + 1),
+                                       rows.len + 1};
+    row_strings.accepts = Slice<uint64_t>{
+        arena->pushTN<uint64_t>(position_count), position_count};
+    size_t p = 0;
+    for (size_t id = 0; id < rows.len; ++id) {
+        row_strings.starts[id] = p;
+
+        Pattern *pattern = rows[id].pattern;
+        for (size_t c = 0; c < pattern->dims.width; ++c) {
+            PatternCell cell =
+                pattern->cells[rows[id].row * pattern->dims.width + c];
+            row_strings.accepts[p++] = allowedValues(cell);
+        }
+    }
+    row_strings.starts[rows.len] = p;
+
+    Arena row_arena = makeArena(dfaArenaSize(row_strings));
+    Dfa row_dfa = buildDfa(&row_arena, row_strings);
+
+    // the sets of rows that end together are the column symbols, the empty
+    // one (state 0's) first
+    size_t row_words = wordsFor(rows.len);
+    Slice<unsigned short> row_out{
+        arena->pushTN<unsigned short>(row_dfa.state_count),
+        row_dfa.state_count};
+    Slice<size_t> symbol_states{arena->pushTN<size_t>(row_dfa.state_count),
+                                0};
+    for (size_t state = 0; state < row_dfa.state_count; ++state) {
+        uint64_t const *ends = &row_dfa.ends[state * row_words];
+
+        size_t symbol = 0;
+        while (symbol < symbol_states.len) {
+            uint64_t const *other =
+                &row_dfa.ends[symbol_states[symbol] * row_words];
+            bool same = true;
+            for (size_t w = 0; w < row_words; ++w) {
+                same = same && other[w] == ends[w];
+            }
+            if (same) {
+                break;
+            }
+            ++symbol;
+        }
+        if (symbol == symbol_states.len) {
+            symbol_states.ptr[symbol_states.len++] = state;
+        }
+        row_out[state] = (unsigned short)symbol;
+    }
+
+    // a variant is the string of its rows, top to bottom, and a row accepts
+    // every symbol it is in
+    size_t symbol_count = symbol_states.len;
+    size_t symbol_words = wordsFor(symbol_count);
+
+    DfaStrings col_strings{symbol_count};
+    col_strings.starts = Slice<size_t>{
+        arena->pushTN<size_t>(variant_count + 1), variant_count + 1};
+    col_strings.accepts = Slice<uint64_t>{
+        arena->pushTN<uint64_t>(row_cap * symbol_words, 0),
+        row_cap * symbol_words};
+    for (size_t v = 0, ref = 0; v < variant_count; ++v) {
+        col_strings.starts[v] = ref;
+
+        size_t height = fused->variants[v].pattern->dims.height;
+        for (size_t r = 0; r < height; ++r, ++ref) {
+            for (size_t symbol = 0; symbol < symbol_count; ++symbol) {
+                uint64_t const *ends =
+                    &row_dfa.ends[symbol_states[symbol] * row_words];
+                if (hasBit(ends, row_ids[ref])) {
+                    setBit(&col_strings.accepts[ref * symbol_words], symbol);
+                }
+            }
+        }
+    }
+    col_strings.starts[variant_count] = row_cap;
+
+    Arena col_arena = makeArena(dfaArenaSize(col_strings));
+    Dfa col_dfa = buildDfa(&col_arena, col_strings);
+
+    printf("%.*s: %zu pattern rows, %zu row states, %zu column symbols, %zu "
+           "column states\n",
+           STR_ARGS(out_fn), rows.len, row_dfa.state_count, symbol_count,
+           col_dfa.state_count);
+
+    writeIncludes(out);
+    fprintf(out, "#include \"../bakerbird.cc\"\n");
+    fprintf(out, "\n");
+
+    writeShorts(out, "row_next",
+                row_dfa.next.slice(0, row_dfa.state_count * class_values));
+    writeShorts(out, "row_out", row_out);
+    writeShorts(out, "col_next",
+                col_dfa.next.slice(0, col_dfa.state_count * symbol_count));
+
+    size_t variant_words = wordsFor(variant_count);
+    fprintf(out, "static unsigned int const col_ends[] = {");
+    size_t match_count = 0;
+    for (size_t state = 0; state <= col_dfa.state_count; ++state) {
+        fprintf(out, "%s%zu,", state % 12 == 0 ? "\n    " : " ", match_count);
+        for (size_t v = 0; state < col_dfa.state_count && v < variant_count;
+             ++v) {
+            match_count +=
+                hasBit(&col_dfa.ends[state * variant_words], v);
+        }
+    }
+    fprintf(out, "\n};\n");
+    fprintf(out, "\n");
+
+    Slice<unsigned short> matches{arena->pushTN<unsigned short>(match_count),
+                                  0};
+    for (size_t state = 0; state < col_dfa.state_count; ++state) {
+        for (size_t v = 0; v < variant_count; ++v) {
+            if (hasBit(&col_dfa.ends[state * variant_words], v)) {
+                matches.ptr[matches.len++] = (unsigned short)v;
+            }
+        }
+    }
+    writeShorts(out, "col_matches", matches);
+
+    fprintf(out, "static BirdVariant const variants[] = {\n");
+    size_t action_count = 0;
+    for (Variant variant : fused->variants) {
+        Pattern *pattern = variant.pattern;
+        fprintf(out, "    {%zu, %zu, %zu, %zu}, // %.*s\n",
+                pattern->dims.height, pattern->dims.width, action_count,
+                pattern->actions.len, STR_ARGS(variant.name));
+        action_count += pattern->actions.len;
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "\n");
+
+    fprintf(out, "static BirdAction const actions[] = {\n");
+    for (Variant variant : fused->variants) {
+        for (Action action : variant.pattern->actions) {
+            char const *kind = action.action == ActionCellType::act_flag
+                                   ? "bak_flag"
+                                   : "bak_execute";
+            fprintf(out, "    {%zu, %zu, BirdActionKind::%s},\n",
+                    action.loc.row, action.loc.col, kind);
+        }
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "\n");
+
+    fprintf(out, "static BirdTables const tables{\n");
+    fprintf(out, "    row_next,    row_out,  %zu, col_next,\n", symbol_count);
+    fprintf(out, "    col_ends, col_matches, variants, actions,\n");
+    fprintf(out, "};\n");
+    fprintf(out, "\n");
+
+    fprintf(out, "static StrSlice rule_name = STR_SLICE(\"%.*s\");\n",
             STR_ARGS(out_fn));
+    fprintf(out, "\n");
+    fprintf(out, "STATE_MAKER(makeState) {\n");
+    fprintf(out, "    BakerBirdRule *internal = new BakerBirdRule();\n");
+    fprintf(out, "    *internal = makeBakerBird(&tables);\n");
+    fprintf(out, "    return internal;\n");
+    fprintf(out, "}\n");
+    fprintf(out, "\n");
+    fprintf(out, "STATE_FREER(freeState, state) {\n");
+    fprintf(out, "    BakerBirdRule *internal = (BakerBirdRule *)state;\n");
+    fprintf(out, "    deleteBakerBird(internal);\n");
+    fprintf(out, "    delete internal;\n");
+    fprintf(out, "}\n");
+    fprintf(out, "\n");
+    fprintf(out, "REGISTERER(regRule, arena, solver, state) {\n");
+    fprintf(out, "    BakerBirdRule *internal = (BakerBirdRule *)state;\n");
+    fprintf(out, "\n");
+    fprintf(out, "    GridSolver::Rule rule = GridSolver::Rule::from(\n");
+    fprintf(out, "        BakerBirdRule::applyRule, "
+                 "BakerBirdRule::onEpochStart, nullptr,\n");
+    fprintf(out, "        internal, rule_name);\n");
+    fprintf(out, "    rule.tier = RuleTier::rt_pattern;\n");
+    fprintf(out, "    solver->registerRule(arena, rule);\n");
     fprintf(out, "}\n");
     fprintf(out, "\n");
     fprintf(out, "DEREGISTERER(deregRule, solver) {\n");
-    fprintf(out, "    solver->deregisterRule(rule_name);\n");
+    fprintf(out, "    return solver->deregisterRule(rule_name).data;\n");
     fprintf(out, "}\n");
     fprintf(out, "\n");
-    fprintf(out, "RulePlugin plugin{regRule, deregRule};\n");
+    fprintf(out, "RulePlugin plugin{regRule, deregRule, makeState, "
+                 "freeState};\n");
+
+    freeArena(&col_arena);
+    freeArena(&row_arena);
 }
+// }}}1
 
 auto usage(char const *path) -> void {
     fprintf(stderr, "%s [filename]\n", path);
+    fprintf(stderr, "%s --fused [filename...]\n", path);
+    fprintf(stderr, "%s --lut [filename...]\n", path);
+    fprintf(stderr, "%s --bird [filename...]\n", path);
     fprintf(stderr, "\n");
     fprintf(stderr, "filename - name of pattern file (.pat) to compile\n");
+    fprintf(stderr, "--fused  - compile every pattern into one rule, %s\n",
+            FUSED_OUT_NAME);
+    fprintf(stderr, "--lut    - the same as a table lookup, %s\n",
+            LUT_OUT_NAME);
+    fprintf(stderr, "--bird   - the same as a whole grid matcher, %s\n",
+            BIRD_OUT_NAME);
+}
+
+// reads every pattern into fused, returns the number of orientations left
+// out as duplicates
+auto readVariants(Arena *arena, Fused *fused, int argc, char const *argv[])
+    -> size_t {
+    size_t removed = 0;
+
+    for (int i = 0; i < argc; ++i) {
+        char const *in_name = argv[i];
+        FileArgs file_args = getFileArgs(arena, in_name);
+
+        Op<StrSlice> contents_op = getContents(arena, in_name);
+        if (!contents_op.valid) {
+            fprintf(stderr, "Failed to read pattern file %s\n", in_name);
+            EXIT(1);
+        }
+
+        Pattern pattern = readPattern(arena, contents_op.get());
+        for (Orientation orientation : orientations) {
+            Pattern oriented = orientPattern(arena, pattern, orientation);
+            if (hasVariant(fused, oriented)) {
+                ++removed;
+            } else {
+                addVariant(fused, oriented, file_args.in_root,
+                           orientation.name);
+            }
+        }
+    }
+
+    return removed;
+}
+
+typedef auto(WriteFusedBody)(FILE *out, StrSlice out_fn, Fused *fused)
+    -> void;
+
+auto writeFused(Arena *arena, int argc, char const *argv[],
+                char const *out_name, StrSlice out_root,
+                WriteFusedBody *write) -> void {
+    // a variant per orientation, and room for patterns up to 8x8
+    Fused fused = makeFused(arena, 8 * argc + 128);
+    size_t removed = readVariants(arena, &fused, argc, argv);
+
+    FILE *out = fopen(out_name, "w");
+    if (out == nullptr) {
+        fprintf(stderr, "Failed to open output file %s\n", out_name);
+        EXIT(1);
+    }
+
+    write(out, out_root, &fused);
+    fflush(out);
+    fclose(out);
+
+    printf("%.*s: %zu of %zu pattern orientations were duplicates\n",
+           STR_ARGS(out_root), removed, orientation_count * argc);
 }
 
 int main(int argc, char const *argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "--fused") == 0) {
+        Arena arena = makeArena(MEGABYTES(10));
+        makeDirAndParentsIfNotExists(&arena, OUT_DIR);
+
+        writeFused(&arena, argc - 2, argv + 2, FUSED_OUT_NAME,
+                   STR_SLICE("pat_fused"), &writeFusedBody);
+
+        freeArena(&arena);
+        return 0;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--lut") == 0) {
+        Arena arena = makeArena(MEGABYTES(10));
+        makeDirAndParentsIfNotExists(&arena, OUT_DIR);
+
+        writeFused(&arena, argc - 2, argv + 2, LUT_OUT_NAME,
+                   STR_SLICE("pat_lut"), &writeLutBody);
+
+        freeArena(&arena);
+        return 0;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bird") == 0) {
+        Arena arena = makeArena(MEGABYTES(10));
+        makeDirAndParentsIfNotExists(&arena, OUT_DIR);
+
+        writeFused(&arena, argc - 2, argv + 2, BIRD_OUT_NAME,
+                   STR_SLICE("pat_bird"), &writeBirdBody);
+
+        freeArena(&arena);
+        return 0;
+    }
+
     if (argc != 2) {
         usage(argv[0]);
         EXIT(1);
@@ -342,9 +1715,12 @@ int main(int argc, char const *argv[]) {
         EXIT(1);
     }
 
-    writeBody(out, file_args.out_root, pattern);
+    size_t removed = writeBody(&arena, out, file_args.out_root, pattern);
     fflush(out);
     fclose(out);
 
+    printf("%.*s: %zu of %zu orientations were duplicates\n",
+           STR_ARGS(file_args.out_root), removed, orientation_count);
+
     freeArena(&arena);
 }
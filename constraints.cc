@@ -0,0 +1,253 @@
+#pragma once
+
+#include "grid.h"
+
+#include "arena.cc"
+#include "op.cc"
+#include "slice.cc"
+
+#include <assert.h>
+#include <stdint.h>
+
+auto isUnknownCell(Cell cell) -> bool {
+    return cell.display_type == CellDisplayType::cdt_hidden ||
+           cell.display_type == CellDisplayType::cdt_maybe_flag;
+}
+
+auto isConstraintCell(Cell cell) -> bool {
+    return cell.display_type == CellDisplayType::cdt_value &&
+           cell.type == CellType::ct_number;
+}
+
+enum CellVerdict : unsigned char {
+    cv_unknown,
+    cv_safe,
+    cv_mine,
+};
+
+// acts on a verdict through the api, returns whether the grid changed
+auto applyVerdict(Grid *grid, GridApi api, Cell *cell, CellVerdict verdict)
+    -> bool {
+    switch (verdict) {
+    case cv_unknown: {
+        return false;
+    }
+    case cv_safe: {
+        if (cell->display_type != CellDisplayType::cdt_hidden) {
+            return false;
+        }
+        api.uncoverSelfAndNeighbors(grid, cell);
+        return true;
+    }
+    case cv_mine: {
+        if (!isUnknownCell(*cell)) {
+            return false;
+        }
+        api.flagCell(grid, cell);
+        return true;
+    }
+    }
+
+    assert(0 && "Unreachable");
+}
+
+// Deductions stay true while the solver keeps going, so a verdict that has not
+// been acted on yet is worth keeping over recomputing all of them.
+auto hasPendingVerdict(Grid *grid, Slice<unsigned char> verdicts) -> bool {
+    for (size_t idx = 0; idx < verdicts.len; ++idx) {
+        Cell cell = grid->cells[idx];
+        switch ((CellVerdict)verdicts[idx]) {
+        case cv_unknown: {
+        } break;
+        case cv_safe: {
+            if (cell.display_type == CellDisplayType::cdt_hidden) {
+                return true;
+            }
+        } break;
+        case cv_mine: {
+            if (isUnknownCell(cell)) {
+                return true;
+            }
+        } break;
+        }
+    }
+    return false;
+}
+
+// The hidden cells next to a revealed number, split into components that do
+// not share a number, with the numbers around each component.
+struct Frontier {
+    static constexpr size_t no_index = SIZE_MAX;
+
+    struct Component {
+        // breadth first from cells to the numbers around them and back, so
+        // the cells of one number end up close together
+        Slice<size_t> cells;
+        Slice<size_t> constraints;
+    };
+
+    Slice<size_t> var_of; // cell -> index into its component's cells
+    Slice<Component> comps;
+    size_t interior_count; // hidden cells next to no number
+    long remaining_mines;
+    bool lost;
+
+    static auto arenaSize(size_t cell_count) -> size_t {
+        return cell_count * (6 * sizeof(size_t) + sizeof(Component)) + 64;
+    }
+};
+
+auto buildFrontier(Arena *arena, Grid *grid) -> Frontier {
+    size_t cell_count = grid->dims.area();
+    size_t width = grid->dims.width;
+
+    Frontier res{};
+    res.var_of = Slice<size_t>{
+        arena->pushTN<size_t>(cell_count, Frontier::no_index), cell_count};
+
+    Slice<size_t> con_of{arena->pushTN<size_t>(cell_count, Frontier::no_index),
+                         cell_count};
+    Slice<size_t> queue{arena->pushTN<size_t>(cell_count), cell_count};
+    Slice<size_t> con_queue{arena->pushTN<size_t>(cell_count), cell_count};
+
+    Frontier::Component *comps =
+        arena->pushTN<Frontier::Component>(cell_count);
+    size_t comp_count = 0;
+
+    res.lost = grid->mines_revealed > 0;
+    res.remaining_mines = (long)grid->mine_count - (long)grid->flags_placed;
+
+    for (size_t start = 0; start < cell_count; ++start) {
+        if (!isUnknownCell(grid->cells[start]) ||
+            res.var_of[start] != Frontier::no_index) {
+            continue;
+        }
+
+        bool touches_constraint = false;
+        {
+            auto neighbor_op = Op<Grid::Neighbor>::empty();
+            auto neighbor_it =
+                grid->neighborIterator(start / width, start % width);
+            while ((neighbor_op = neighbor_it.next()).valid) {
+                if (isConstraintCell(*neighbor_op.get().cell)) {
+                    touches_constraint = true;
+                    break;
+                }
+            }
+        }
+
+        if (!touches_constraint) {
+            ++res.interior_count;
+            continue;
+        }
+
+        size_t var_count = 0;
+        size_t con_count = 0;
+
+        queue[var_count] = start;
+        res.var_of[start] = var_count++;
+
+        for (size_t q = 0; q < var_count; ++q) {
+            size_t cell_idx = queue[q];
+
+            auto con_op = Op<Grid::Neighbor>::empty();
+            auto con_it =
+                grid->neighborIterator(cell_idx / width, cell_idx % width);
+            while ((con_op = con_it.next()).valid) {
+                Grid::Neighbor con = con_op.get();
+                size_t con_idx = con.loc.row * width + con.loc.col;
+                if (!isConstraintCell(*con.cell) ||
+                    con_of[con_idx] != Frontier::no_index) {
+                    continue;
+                }
+
+                con_queue[con_count] = con_idx;
+                con_of[con_idx] = con_count++;
+
+                auto var_op = Op<Grid::Neighbor>::empty();
+                auto var_it = grid->neighborIterator(con.loc);
+                while ((var_op = var_it.next()).valid) {
+                    Grid::Neighbor var = var_op.get();
+                    size_t var_idx = var.loc.row * width + var.loc.col;
+                    if (!isUnknownCell(*var.cell) ||
+                        res.var_of[var_idx] != Frontier::no_index) {
+                        continue;
+                    }
+
+                    queue[var_count] = var_idx;
+                    res.var_of[var_idx] = var_count++;
+                }
+            }
+        }
+
+        Frontier::Component &comp = comps[comp_count++];
+        comp.cells =
+            Slice<size_t>{arena->pushTN<size_t>(var_count), var_count};
+        comp.constraints =
+            Slice<size_t>{arena->pushTN<size_t>(con_count), con_count};
+
+        for (size_t i = 0; i < var_count; ++i) {
+            comp.cells[i] = queue[i];
+        }
+        for (size_t i = 0; i < con_count; ++i) {
+            comp.constraints[i] = con_queue[i];
+        }
+    }
+
+    res.comps = Slice<Frontier::Component>{comps, comp_count};
+    return res;
+}
+
+// What the player could see the last time it was updated. Rules whose
+// deductions only depend on that can skip recomputing them while nothing
+// changed.
+struct SeenPlane {
+    Slice<unsigned char> keys;
+
+    static auto key(Cell cell) -> unsigned char {
+        if (isConstraintCell(cell)) {
+            return (cell.number << 2) | cell.display_type;
+        }
+        return cell.display_type;
+    }
+
+    auto init(Arena *arena, size_t cell_count) -> void {
+        // 0xff is not a key any cell can have, so the first update reports a
+        // change
+        this->keys = Slice<unsigned char>{
+            arena->pushTN<unsigned char>(cell_count, 0xff), cell_count};
+    }
+
+    // whether grid could have come from the one the keys were taken from:
+    // revealed cells never change and flags only by hand, so anything else is
+    // a new grid (or a reset one) and verdicts from the old one are stale
+    auto extends(Grid *grid) -> bool {
+        assert(grid->cells.len == this->keys.len && "Mismatched grid");
+
+        for (size_t idx = 0; idx < this->keys.len; ++idx) {
+            unsigned char display = this->keys[idx] & 0x3;
+            if (display != CellDisplayType::cdt_value &&
+                display != CellDisplayType::cdt_flag) {
+                continue;
+            }
+            if (this->keys[idx] != key(grid->cells[idx])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    auto update(Grid *grid) -> bool {
+        assert(grid->cells.len == this->keys.len && "Mismatched grid");
+
+        bool changed = false;
+        for (size_t idx = 0; idx < this->keys.len; ++idx) {
+            unsigned char cell_key = key(grid->cells[idx]);
+            if (this->keys[idx] != cell_key) {
+                this->keys[idx] = cell_key;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+};
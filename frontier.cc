@@ -0,0 +1,746 @@
+#include "grid.h"
+#include "solver.h"
+
+#include "arena.cc"
+#include "constraints.cc"
+#include "dirutils.cc"
+#include "op.cc"
+#include "slice.cc"
+#include "strslice.cc"
+#include "utils.cc"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// Exact reasoning over the whole frontier: the hidden cells next to revealed
+// numbers are split into independent components, every consistent mine
+// assignment of each component is enumerated, and the components are combined
+// under the total mine count. Cells that are a mine in none (or all) of the
+// weighted assignments are revealed (or flagged).
+
+struct FrontierRule {
+    // components are enumerated with one bit per cell
+    static constexpr size_t max_component_vars = 64;
+    static constexpr size_t component_node_budget = 1 << 20;
+    static constexpr size_t epoch_node_budget = 1 << 24;
+
+    struct ComponentReport {
+        size_t vars;
+        size_t constraints;
+        size_t solutions;
+        size_t nodes;
+        uint64_t ns;
+        bool aborted;
+    };
+
+    struct Component {
+        Slice<size_t> cells; // enumeration order, bit i is cells[i]
+        Slice<uint64_t> masks;
+        Slice<unsigned char> values;
+        Slice<double> counts; // solutions by mine count
+        Slice<double> mines;  // [var * (vars + 1) + k]
+        ComponentReport report;
+    };
+
+    // a list of distributions over a mine count, in log space so the products
+    // of large solution counts do not overflow; -INFINITY is an exact zero
+    struct Dist {
+        Slice<double> lw;
+    };
+
+    struct Enumeration {
+        Component *comp;
+        Slice<unsigned char> var_cons_len;
+        Slice<size_t> var_cons; // [var * 8 + i]
+        size_t node_budget;
+        size_t nodes;
+        bool aborted;
+
+        auto visit(size_t var, uint64_t assigned, uint64_t mines) -> void {
+            if (this->aborted) {
+                return;
+            }
+            if (++this->nodes > this->node_budget) {
+                this->aborted = true;
+                return;
+            }
+
+            size_t var_count = this->comp->cells.len;
+            if (var == var_count) {
+                this->record(mines);
+                return;
+            }
+
+            uint64_t bit = (uint64_t)1 << var;
+            assigned |= bit;
+
+            if (this->consistent(var, assigned, mines)) {
+                this->visit(var + 1, assigned, mines);
+            }
+            if (this->consistent(var, assigned, mines | bit)) {
+                this->visit(var + 1, assigned, mines | bit);
+            }
+        }
+
+        auto consistent(size_t var, uint64_t assigned, uint64_t mines)
+            -> bool {
+            for (size_t i = 0; i < this->var_cons_len[var]; ++i) {
+                size_t con = this->var_cons[var * 8 + i];
+                uint64_t mask = this->comp->masks[con];
+                size_t value = this->comp->values[con];
+
+                size_t placed = __builtin_popcountll(mines & mask);
+                size_t open = __builtin_popcountll(mask & ~assigned);
+                if (placed > value || placed + open < value) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        auto record(uint64_t mines) -> void {
+            size_t stride = this->comp->cells.len + 1;
+            size_t k = __builtin_popcountll(mines);
+
+            this->comp->counts[k] += 1;
+            while (mines != 0) {
+                size_t var = __builtin_ctzll(mines);
+                this->comp->mines[var * stride + k] += 1;
+                mines &= mines - 1;
+            }
+        }
+    };
+
+    static auto applyRule(Grid *grid, GridApi api, size_t row, size_t col,
+                          void *data) -> bool {
+        auto rule = static_cast<FrontierRule *>(data);
+        return rule->apply(grid, api, row, col);
+    }
+
+    static auto onEpochStart(Grid *grid, GridApi, void *data) -> void {
+        auto rule = static_cast<FrontierRule *>(data);
+        rule->onStart(grid);
+    }
+
+    Arena arena; // the planes, then the frontier
+    Dims dims;
+    size_t planes_end;
+    // the components with their count rows, and the distributions combining
+    // them; sized by the frontier each epoch finds, and grown when one needs
+    // more
+    Arena counts_arena;
+
+    SeenPlane seen;
+    Slice<unsigned char> verdicts;
+    Slice<float> probabilities; // -1 where the cell is not hidden
+    Slice<ComponentReport> reports;
+
+    // per computation scratch
+    Frontier frontier;
+    Slice<Component> comps;
+
+    auto apply(Grid *grid, GridApi api, size_t row, size_t col) -> bool {
+        size_t idx = row * grid->dims.width + col;
+        if (idx >= this->verdicts.len) {
+            return false;
+        }
+
+        Cell &cell = (*grid)[row][col];
+        return applyVerdict(grid, api, &cell, (CellVerdict)this->verdicts[idx]);
+    }
+
+    auto onStart(Grid *grid) -> void {
+        if (this->dims.width != grid->dims.width ||
+            this->dims.height != grid->dims.height) {
+            this->reserve(grid->dims);
+        }
+
+        if (this->seen.extends(grid) &&
+            hasPendingVerdict(grid, this->verdicts)) {
+            return;
+        }
+        if (!this->seen.update(grid)) {
+            return;
+        }
+
+        this->arena.reset(this->planes_end);
+
+        for (size_t idx = 0; idx < this->verdicts.len; ++idx) {
+            this->verdicts[idx] = cv_unknown;
+            this->probabilities[idx] = -1.0f;
+        }
+
+        this->frontier = buildFrontier(&this->arena, grid);
+        if (this->frontier.lost) {
+            this->comps = Slice<Component>{nullptr, 0};
+            this->reports = Slice<ComponentReport>{nullptr, 0};
+            return;
+        }
+
+        this->reserveCounts();
+        this->buildComponents(grid);
+
+        bool all_enumerated = this->enumerateComponents();
+        if (all_enumerated) {
+            this->combine(grid);
+        } else {
+            // without every component the mine count cannot be used, but
+            // whatever holds in all of a component's assignments still does
+            for (Component &comp : this->comps) {
+                if (!comp.report.aborted) {
+                    this->localVerdicts(&comp);
+                }
+            }
+        }
+
+#ifdef FRONTIER_REPORT
+        this->printReport();
+#endif
+    }
+
+    auto reserve(Dims dims) -> void {
+        size_t cell_count = dims.area();
+
+        // the planes and the frontier
+        size_t needed = cell_count * (2 + sizeof(float)) +
+                        Frontier::arenaSize(cell_count) + 4096;
+
+        if (this->arena.cap < needed) {
+            if (this->arena.ptr != nullptr) {
+                freeArena(&this->arena);
+            }
+            this->arena = makeArena(needed);
+        }
+        this->arena.reset(0);
+
+        this->dims = dims;
+
+        this->seen.init(&this->arena, cell_count);
+        this->verdicts = Slice<unsigned char>{
+            this->arena.pushTN<unsigned char>(cell_count, cv_unknown),
+            cell_count};
+        this->probabilities = Slice<float>{
+            this->arena.pushTN<float>(cell_count, -1.0f), cell_count};
+
+        this->planes_end = this->arena.len;
+    }
+
+    auto reserveCounts() -> void {
+        size_t comp_count = this->frontier.comps.len;
+
+        // per component its constraints, its (vars + 1) square of counts and
+        // a report; the enumeration scratch of one at a time
+        size_t needed = comp_count * (sizeof(Component) +
+                                      sizeof(ComponentReport) + 16);
+        size_t scratch = 0;
+        size_t var_total = 0;
+        for (Frontier::Component &f_comp : this->frontier.comps) {
+            size_t var_count = f_comp.cells.len;
+            var_total += var_count;
+            if (var_count > max_component_vars) {
+                continue;
+            }
+
+            needed += f_comp.constraints.len * (sizeof(uint64_t) + 1) +
+                      (var_count + 1) * (var_count + 1) * sizeof(double) + 16;
+
+            size_t en = var_count * (1 + 8 * sizeof(size_t)) + 16;
+            scratch = en > scratch ? en : scratch;
+        }
+        needed += scratch;
+
+        // the combination recurses over halves of the component list and
+        // keeps three distributions alive per level, none longer than every
+        // variable taking a mine
+        size_t depth = 2;
+        while (((size_t)1 << depth) < comp_count) {
+            ++depth;
+        }
+        needed += ((3 * depth + 4) * (var_total + 1) + max_component_vars + 1) *
+                      sizeof(double) +
+                  4096;
+
+        if (this->counts_arena.cap < needed) {
+            if (this->counts_arena.ptr != nullptr) {
+                freeArena(&this->counts_arena);
+            }
+            size_t grown = 2 * this->counts_arena.cap;
+            this->counts_arena = makeArena(grown > needed ? grown : needed);
+        }
+        this->counts_arena.reset(0);
+    }
+
+    auto buildComponents(Grid *grid) -> void {
+        size_t comp_count = this->frontier.comps.len;
+        this->comps = Slice<Component>{
+            this->counts_arena.pushTN<Component>(comp_count), comp_count};
+
+        for (size_t i = 0; i < comp_count; ++i) {
+            Frontier::Component &f_comp = this->frontier.comps[i];
+            Component &comp = this->comps[i];
+
+            size_t var_count = f_comp.cells.len;
+            size_t con_count = f_comp.constraints.len;
+
+            comp.cells = f_comp.cells;
+            comp.report.vars = var_count;
+            comp.report.constraints = con_count;
+
+            if (var_count > max_component_vars) {
+                comp.report.aborted = true;
+                continue;
+            }
+
+            comp.masks = Slice<uint64_t>{
+                this->counts_arena.pushTN<uint64_t>(con_count), con_count};
+            comp.values = Slice<unsigned char>{
+                this->counts_arena.pushTN<unsigned char>(con_count), con_count};
+
+            for (size_t c = 0; c < con_count; ++c) {
+                size_t con_idx = f_comp.constraints[c];
+
+                uint64_t mask = 0;
+                auto var_op = Op<Grid::Neighbor>::empty();
+                auto var_it = grid->neighborIterator(
+                    con_idx / grid->dims.width, con_idx % grid->dims.width);
+                while ((var_op = var_it.next()).valid) {
+                    Grid::Neighbor var = var_op.get();
+                    if (!isUnknownCell(*var.cell)) {
+                        continue;
+                    }
+
+                    size_t var_idx =
+                        var.loc.row * grid->dims.width + var.loc.col;
+                    mask |= (uint64_t)1 << this->frontier.var_of[var_idx];
+                }
+
+                comp.masks[c] = mask;
+                comp.values[c] = grid->cells[con_idx].eff_number;
+            }
+        }
+    }
+
+    auto enumerateComponents() -> bool {
+        bool all_enumerated = true;
+        size_t epoch_nodes = 0;
+
+        for (Component &comp : this->comps) {
+            if (comp.report.aborted) {
+                all_enumerated = false;
+                continue;
+            }
+
+            size_t var_count = comp.cells.len;
+            size_t con_count = comp.masks.len;
+            size_t stride = var_count + 1;
+
+            comp.counts = Slice<double>{
+                this->counts_arena.pushTN<double>(stride, 0.0), stride};
+            comp.mines = Slice<double>{
+                this->counts_arena.pushTN<double>(var_count * stride, 0.0),
+                var_count * stride};
+
+            auto mark = this->counts_arena.mark();
+
+            Enumeration en{};
+            en.comp = &comp;
+            en.var_cons_len = Slice<unsigned char>{
+                this->counts_arena.pushTN<unsigned char>(var_count, 0),
+                var_count};
+            en.var_cons = Slice<size_t>{
+                this->counts_arena.pushTN<size_t>(var_count * 8),
+                var_count * 8};
+
+            // a constraint is checked when the last of its cells is assigned
+            // and on every cell before that, so each cell lists all of its
+            // constraints
+            for (size_t c = 0; c < con_count; ++c) {
+                uint64_t mask = comp.masks[c];
+                while (mask != 0) {
+                    size_t var = __builtin_ctzll(mask);
+                    en.var_cons[var * 8 + en.var_cons_len[var]++] = c;
+                    mask &= mask - 1;
+                }
+            }
+
+            size_t remaining_budget = epoch_node_budget > epoch_nodes
+                                          ? epoch_node_budget - epoch_nodes
+                                          : 0;
+            en.node_budget = remaining_budget < component_node_budget
+                                 ? remaining_budget
+                                 : component_node_budget;
+
+            uint64_t start_ns = nanoTime();
+            en.visit(0, 0, 0);
+            comp.report.ns = nanoTime() - start_ns;
+
+            epoch_nodes += en.nodes;
+            comp.report.nodes = en.nodes;
+            comp.report.aborted = en.aborted;
+
+            for (double count : comp.counts) {
+                comp.report.solutions += (size_t)count;
+            }
+
+            if (en.aborted) {
+                all_enumerated = false;
+            }
+        }
+
+        size_t comp_count = this->comps.len;
+        this->reports = Slice<ComponentReport>{
+            this->counts_arena.pushTN<ComponentReport>(comp_count), comp_count};
+        for (size_t i = 0; i < comp_count; ++i) {
+            this->reports[i] = this->comps[i].report;
+        }
+
+        return all_enumerated;
+    }
+
+    auto localVerdicts(Component *comp) -> void {
+        size_t var_count = comp->cells.len;
+        size_t stride = var_count + 1;
+
+        double total = 0;
+        for (double count : comp->counts) {
+            total += count;
+        }
+        if (total == 0) {
+            return;
+        }
+
+        for (size_t var = 0; var < var_count; ++var) {
+            double as_mine = 0;
+            for (size_t k = 0; k < stride; ++k) {
+                as_mine += comp->mines[var * stride + k];
+            }
+
+            size_t cell_idx = comp->cells[var];
+            this->probabilities[cell_idx] = as_mine / total;
+            if (as_mine == 0) {
+                this->verdicts[cell_idx] = cv_safe;
+            } else if (as_mine == total) {
+                this->verdicts[cell_idx] = cv_mine;
+            }
+        }
+    }
+
+    auto combine(Grid *grid) -> void {
+        if (this->frontier.remaining_mines < 0) {
+            return;
+        }
+
+        size_t max_sum = this->frontier.remaining_mines;
+
+        Dist none = this->makeDist(1);
+        none.lw[0] = 0;
+
+        // every component is finished against the distribution of all the
+        // others, which the recursion builds up half by half
+        if (this->comps.len > 0) {
+            this->combineRange(0, this->comps.len, none, max_sum);
+        }
+
+        size_t interior_count = this->frontier.interior_count;
+        if (interior_count == 0) {
+            return;
+        }
+
+        auto mark = this->counts_arena.mark();
+        Dist all = this->convolveRange(0, this->comps.len, max_sum);
+
+        double total = -INFINITY;
+        double expected = -INFINITY;
+        bool any_mine = false;
+        bool any_safe = false;
+        for (size_t s = 0; s < all.lw.len; ++s) {
+            if (all.lw[s] == -INFINITY) {
+                continue;
+            }
+
+            size_t left = max_sum - s;
+            if (left > interior_count) {
+                continue;
+            }
+
+            double w = all.lw[s] + logChoose(interior_count, left);
+            total = logAdd(total, w);
+            if (left > 0) {
+                expected = logAdd(expected, w + log((double)left));
+            }
+
+            any_mine = any_mine || left > 0;
+            any_safe = any_safe || left < interior_count;
+        }
+
+        if (total == -INFINITY) {
+            return;
+        }
+
+        float prob = exp(expected - total) / interior_count;
+
+        for (size_t idx = 0; idx < grid->cells.len; ++idx) {
+            if (!isUnknownCell(grid->cells[idx]) ||
+                this->frontier.var_of[idx] != Frontier::no_index) {
+                continue;
+            }
+
+            this->probabilities[idx] = any_mine ? prob : 0.0f;
+            if (!any_mine) {
+                this->verdicts[idx] = cv_safe;
+            } else if (!any_safe) {
+                this->verdicts[idx] = cv_mine;
+            }
+        }
+    }
+
+    auto combineRange(size_t lo, size_t hi, Dist outside, size_t max_sum)
+        -> void {
+        if (hi - lo == 1) {
+            this->finish(&this->comps[lo], outside, max_sum);
+            return;
+        }
+
+        size_t mid = lo + (hi - lo) / 2;
+
+        {
+            auto mark = this->counts_arena.mark();
+            Dist right = this->convolveRange(mid, hi, max_sum);
+            Dist left_outside = this->convolve(outside, right, max_sum);
+            this->combineRange(lo, mid, left_outside, max_sum);
+        }
+
+        {
+            auto mark = this->counts_arena.mark();
+            Dist left = this->convolveRange(lo, mid, max_sum);
+            Dist right_outside = this->convolve(outside, left, max_sum);
+            this->combineRange(mid, hi, right_outside, max_sum);
+        }
+    }
+
+    auto finish(Component *comp, Dist outside, size_t max_sum) -> void {
+        size_t var_count = comp->cells.len;
+        size_t stride = var_count + 1;
+
+        size_t interior_count = this->frontier.interior_count;
+
+        auto mark = this->counts_arena.mark();
+        Slice<double> weights{
+            this->counts_arena.pushTN<double>(stride, -INFINITY), stride};
+
+        double total = -INFINITY;
+        for (size_t k = 0; k < stride && k <= max_sum; ++k) {
+            if (comp->counts[k] == 0) {
+                continue;
+            }
+
+            double rest = -INFINITY;
+            for (size_t s = 0; s < outside.lw.len && k + s <= max_sum; ++s) {
+                if (outside.lw[s] == -INFINITY) {
+                    continue;
+                }
+
+                size_t left = max_sum - k - s;
+                if (left > interior_count) {
+                    continue;
+                }
+
+                rest = logAdd(rest, outside.lw[s] +
+                                        logChoose(interior_count, left));
+            }
+
+            weights[k] = rest;
+            total = logAdd(total, log(comp->counts[k]) + rest);
+        }
+
+        if (total == -INFINITY) {
+            // the mine count contradicts what is visible, nothing is certain
+            return;
+        }
+
+        for (size_t var = 0; var < var_count; ++var) {
+            bool any_mine = false;
+            bool any_safe = false;
+            double prob = 0;
+
+            for (size_t k = 0; k < stride; ++k) {
+                if (weights[k] == -INFINITY) {
+                    continue;
+                }
+
+                double as_mine = comp->mines[var * stride + k];
+                any_mine = any_mine || as_mine > 0;
+                any_safe = any_safe || as_mine < comp->counts[k];
+
+                if (as_mine > 0) {
+                    prob += exp(log(as_mine) + weights[k] - total);
+                }
+            }
+
+            size_t cell_idx = comp->cells[var];
+            this->probabilities[cell_idx] = prob;
+            if (!any_mine) {
+                this->verdicts[cell_idx] = cv_safe;
+            } else if (!any_safe) {
+                this->verdicts[cell_idx] = cv_mine;
+            }
+        }
+    }
+
+    auto convolveRange(size_t lo, size_t hi, size_t max_sum) -> Dist {
+        size_t len = 1;
+        for (size_t i = lo; i < hi; ++i) {
+            len += this->comps[i].cells.len;
+        }
+        if (len > max_sum + 1) {
+            len = max_sum + 1;
+        }
+
+        // ping-pong between two buffers of the final size
+        Dist cur = this->makeDist(len);
+        Dist next = this->makeDist(len);
+        cur.lw[0] = 0;
+        cur.lw.len = 1;
+
+        for (size_t i = lo; i < hi; ++i) {
+            Component &comp = this->comps[i];
+
+            size_t out_len = cur.lw.len + comp.cells.len;
+            if (out_len > len) {
+                out_len = len;
+            }
+
+            next.lw.len = out_len;
+            for (size_t s = 0; s < out_len; ++s) {
+                next.lw[s] = -INFINITY;
+            }
+
+            for (size_t s = 0; s < cur.lw.len; ++s) {
+                if (cur.lw[s] == -INFINITY) {
+                    continue;
+                }
+                for (size_t k = 0; k < comp.counts.len && s + k < out_len;
+                     ++k) {
+                    if (comp.counts[k] == 0) {
+                        continue;
+                    }
+                    next.lw[s + k] =
+                        logAdd(next.lw[s + k], cur.lw[s] + log(comp.counts[k]));
+                }
+            }
+
+            Dist tmp = cur;
+            cur = next;
+            next = tmp;
+        }
+
+        return cur;
+    }
+
+    auto convolve(Dist lhs, Dist rhs, size_t max_sum) -> Dist {
+        size_t len = lhs.lw.len + rhs.lw.len - 1;
+        if (len > max_sum + 1) {
+            len = max_sum + 1;
+        }
+
+        Dist res = this->makeDist(len);
+        for (size_t a = 0; a < lhs.lw.len; ++a) {
+            if (lhs.lw[a] == -INFINITY) {
+                continue;
+            }
+            for (size_t b = 0; b < rhs.lw.len && a + b < len; ++b) {
+                if (rhs.lw[b] == -INFINITY) {
+                    continue;
+                }
+                res.lw[a + b] = logAdd(res.lw[a + b], lhs.lw[a] + rhs.lw[b]);
+            }
+        }
+        return res;
+    }
+
+    auto makeDist(size_t len) -> Dist {
+        return Dist{Slice<double>{
+            this->counts_arena.pushTN<double>(len, -INFINITY), len}};
+    }
+
+    auto printReport() -> void {
+        fprintf(stderr, "frontier: %zu components, %zu interior cells\n",
+                this->reports.len, this->frontier.interior_count);
+        for (size_t i = 0; i < this->reports.len; ++i) {
+            ComponentReport &report = this->reports[i];
+            fprintf(stderr,
+                    "  [%zu] vars %zu constraints %zu solutions %zu nodes %zu "
+                    "%.3fms%s\n",
+                    i, report.vars, report.constraints, report.solutions,
+                    report.nodes, report.ns / 1e6,
+                    report.aborted ? " (aborted)" : "");
+        }
+    }
+
+    static auto logAdd(double lhs, double rhs) -> double {
+        if (lhs == -INFINITY) {
+            return rhs;
+        }
+        if (rhs == -INFINITY) {
+            return lhs;
+        }
+        if (lhs < rhs) {
+            double tmp = lhs;
+            lhs = rhs;
+            rhs = tmp;
+        }
+        return lhs + log1p(exp(rhs - lhs));
+    }
+
+    static auto logChoose(size_t n, size_t k) -> double {
+        return lgamma(n + 1.0) - lgamma(k + 1.0) - lgamma(n - k + 1.0);
+    }
+};
+
+auto makeFrontier() -> FrontierRule {
+    FrontierRule rule{};
+    return rule;
+}
+
+auto deleteFrontier(FrontierRule *rule) -> void {
+    if (rule->arena.ptr != nullptr) {
+        freeArena(&rule->arena);
+    }
+    if (rule->counts_arena.ptr != nullptr) {
+        freeArena(&rule->counts_arena);
+    }
+    *rule = FrontierRule{};
+}
+
+static StrSlice rule_name = STR_SLICE("frontier");
+
+STATE_MAKER(makeState) {
+    FrontierRule *internal = new FrontierRule();
+    *internal = makeFrontier();
+    return internal;
+}
+
+STATE_FREER(freeState, state) {
+    FrontierRule *internal = (FrontierRule *)state;
+    deleteFrontier(internal);
+    delete internal;
+}
+
+REGISTERER(regRule, arena, solver, state) {
+    FrontierRule *internal = (FrontierRule *)state;
+
+    GridSolver::Rule rule =
+        GridSolver::Rule::from(FrontierRule::applyRule,
+                               FrontierRule::onEpochStart, nullptr, internal,
+                               rule_name);
+    rule.tier = RuleTier::rt_exact;
+    solver->registerRule(arena, rule);
+}
+
+DEREGISTERER(deregRule, solver) {
+    return solver->deregisterRule(rule_name).data;
+}
+
+RulePlugin plugin{regRule, deregRule, makeState, freeState};
@@ -52,7 +52,7 @@ auto registerPatterns(Arena *arena, GridSolver *solver) -> void {
     assert(initialized && "Registering uninitialized");
 
     for (size_t i = 0; i < plugin_count; ++i) {
-        plugins[i]->regRule(arena, solver);
+        plugins[i]->registerWith(arena, solver);
     }
 }
 
@@ -60,6 +60,6 @@ auto deregisterPatterns(GridSolver *solver) -> void {
     assert(initialized && "Deregistering uninitialized");
 
     for (size_t i = 0; i < plugin_count; ++i) {
-        plugins[i]->deregRule(solver);
+        plugins[i]->deregisterFrom(solver);
     }
 }
@@ -5,20 +5,151 @@
 #include "arena.cc"
 #include "dirutils.cc"
 #include "op.cc"
+#include "random.cc"
 #include "slice.cc"
 
+#ifdef GRID_BITBOARD
+#include "bitboard.cc"
+#endif
+
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+static auto addHiddenNeighbor(Grid *grid, Location loc, int delta) -> void {
+    auto neighbor_op = Op<Grid::Neighbor>::empty();
+    auto neighbor_it = grid->neighborIterator(loc);
+    while ((neighbor_op = neighbor_it.next()).valid) {
+        (*neighbor_op.get().cell).hidden_count += delta;
+    }
+}
+
+// journal {{{1
+static auto journalChange(Grid *grid, Location loc, CellDisplayType before)
+    -> void {
+    Journal *journal = grid->journal;
+    if (journal == nullptr || journal->depth == 0) {
+        return;
+    }
+
+    size_t cap = journal->arena.cap / sizeof(Journal::Entry);
+    if (journal->entries.len == cap) {
+        Journal grown = makeJournal(cap == 0 ? 16 : 2 * cap);
+        for (size_t i = 0; i < journal->entries.len; ++i) {
+            grown.entries.ptr[i] = journal->entries[i];
+        }
+        grown.entries.len = journal->entries.len;
+        grown.depth = journal->depth;
+
+        freeJournal(journal);
+        *journal = grown;
+    }
+
+    size_t idx = loc.row * grid->dims.width + loc.col;
+    journal->entries.ptr[journal->entries.len++] = {idx, before};
+}
+
+// Moves a cell from whatever it shows to `to` and fixes up everything that
+// depends on it; any change the grid functions make is one of these moves.
+static auto setDisplay(Grid *grid, Location loc, CellDisplayType to) -> void {
+    Cell &cell = (*grid)[loc];
+    CellDisplayType from = cell.display_type;
+
+    int hidden = (to == cdt_hidden) - (from == cdt_hidden);
+    int flagged = (to == cdt_flag) - (from == cdt_flag);
+
+    if (hidden != 0) {
+        addHiddenNeighbor(grid, loc, hidden);
+    }
+    if (flagged != 0) {
+        grid->flags_placed += flagged;
+
+        auto neighbor_op = Op<Grid::Neighbor>::empty();
+        auto neighbor_it = grid->neighborIterator(loc);
+        while ((neighbor_op = neighbor_it.next()).valid) {
+            (*neighbor_op.get().cell).eff_number -= flagged;
+        }
+    }
+
+    size_t &revealed = cell.type == CellType::ct_mine ? grid->mines_revealed
+                                                      : grid->safe_revealed;
+    if (from == cdt_value) {
+        --revealed;
+    }
+    if (to == cdt_value) {
+        ++revealed;
+    }
+
+    cell.display_type = to;
+}
+
+auto makeJournal(size_t capacity) -> Journal {
+    Journal journal{};
+    journal.arena = makeArena(capacity * sizeof(Journal::Entry));
+    journal.entries = Slice<Journal::Entry>{
+        journal.arena.pushTN<Journal::Entry>(capacity), 0};
+    return journal;
+}
+
+auto freeJournal(Journal *journal) -> void {
+    freeArena(&journal->arena);
+    *journal = Journal{};
+}
+
+// returns the mark to commit or roll back to, transactions nest
+auto beginTransaction(Grid *grid) -> size_t {
+    assert(grid->journal != nullptr && "Grid has no journal");
+
+    ++grid->journal->depth;
+    return grid->journal->entries.len;
+}
+
+// keeps the changes since mark; once the outermost transaction is committed
+// there is nothing left to roll back to
+auto commitTransaction(Grid *grid, size_t mark) -> void {
+    Journal *journal = grid->journal;
+    assert(journal != nullptr && journal->depth > 0 && "No transaction");
+    assert(mark <= journal->entries.len && "Invalid mark");
+
+    if (--journal->depth == 0) {
+        journal->entries.len = 0;
+    }
+}
+
+auto rollbackTransaction(Grid *grid, size_t mark) -> void {
+    Journal *journal = grid->journal;
+    assert(journal != nullptr && journal->depth > 0 && "No transaction");
+    assert(mark <= journal->entries.len && "Invalid mark");
+
+    size_t width = grid->dims.width;
+    while (journal->entries.len > mark) {
+        Journal::Entry entry = journal->entries[journal->entries.len - 1];
+        --journal->entries.len;
+        setDisplay(grid, Location{entry.idx / width, entry.idx % width},
+                   entry.before);
+    }
+
+    --journal->depth;
+}
+// }}}1
+
 auto flagCell(Grid *grid, Location loc) -> void {
     Cell &cell = (*grid)[loc];
     if (cell.display_type == CellDisplayType::cdt_flag) {
         return;
     }
-
+    journalChange(grid, loc, cell.display_type);
+
+    if (cell.display_type == CellDisplayType::cdt_hidden) {
+        addHiddenNeighbor(grid, loc, -1);
+    } else if (cell.display_type == CellDisplayType::cdt_value) {
+        // continuing after a lost game flags the mine that was clicked
+        assert(cell.type == CellType::ct_mine && "Flagging a revealed number");
+        --grid->mines_revealed;
+    }
     cell.display_type = CellDisplayType::cdt_flag;
+    ++grid->flags_placed;
 
     auto neighbor_op = Op<Grid::Neighbor>::empty();
     auto neighbor_it = grid->neighborIterator(loc);
@@ -32,13 +163,23 @@ auto flagCell(Grid *grid, Cell *cell) -> void {
     flagCell(grid, cell_loc);
 }
 
+// also takes back a maybe_flag, which never counted against the neighbors
 auto unflagCell(Grid *grid, Location loc) -> void {
     Cell &cell = (*grid)[loc];
+    if (cell.display_type == CellDisplayType::cdt_maybe_flag) {
+        journalChange(grid, loc, cell.display_type);
+        cell.display_type = CellDisplayType::cdt_hidden;
+        addHiddenNeighbor(grid, loc, 1);
+        return;
+    }
     if (cell.display_type != CellDisplayType::cdt_flag) {
         return;
     }
+    journalChange(grid, loc, cell.display_type);
 
     cell.display_type = CellDisplayType::cdt_hidden;
+    addHiddenNeighbor(grid, loc, 1);
+    --grid->flags_placed;
 
     auto neighbor_op = Op<Grid::Neighbor>::empty();
     auto neighbor_it = grid->neighborIterator(loc);
@@ -52,7 +193,11 @@ auto unflagCell(Grid *grid, Cell *cell) -> void {
     unflagCell(grid, cell_loc);
 }
 
+// not journaled, a transaction should be rolled back instead
 auto resetGrid(Grid *grid) -> void {
+    assert((grid->journal == nullptr || grid->journal->depth == 0) &&
+           "Resetting inside a transaction");
+
     for (auto &cell : grid->cells) {
         switch (cell.display_type) {
         case cdt_flag: {
@@ -67,30 +212,78 @@ auto resetGrid(Grid *grid) -> void {
         } break;
         }
     }
+
+    // everything is hidden again
+    for (auto &cell : grid->cells) {
+        Location loc = grid->cellLocation(&cell);
+        cell.hidden_count = neighborCount(loc, grid->dims);
+    }
+    grid->safe_revealed = 0;
+    grid->mines_revealed = 0;
 }
 
-auto uncoverSelfAndNeighbors(Grid *grid, Location loc) -> void {
+static auto revealCell(Grid *grid, Cell *cell, Location loc) -> void {
+    journalChange(grid, loc, cell->display_type);
+    cell->display_type = CellDisplayType::cdt_value;
+    addHiddenNeighbor(grid, loc, -1);
+    ++grid->safe_revealed;
+}
+
+// Reveals loc and, breadth first, the neighbors of every zero revealed along
+// the way. The cells are pushed onto the arena as they are revealed, that list
+// is the queue of the fill and what is returned (as cell indices).
+auto uncoverRegion(Arena *arena, Grid *grid, Location loc) -> Slice<size_t> {
     Cell &cell = (*grid)[loc];
-    if (cell.display_type != CellDisplayType::cdt_hidden) {
-        return;
+    if (cell.display_type != CellDisplayType::cdt_hidden ||
+        cell.type != CellType::ct_number) {
+        return Slice<size_t>{nullptr, 0};
     }
 
-    switch (cell.type) {
-    case ct_number: {
-        cell.display_type = CellDisplayType::cdt_value;
-        if (cell.number == 0) {
-            auto neighbor_op = Op<Grid::Neighbor>::empty();
-            auto neighbor_it = grid->neighborIterator(loc);
-            while ((neighbor_op = neighbor_it.next()).valid) {
-                Grid::Neighbor neighbor = neighbor_op.get();
-                uncoverSelfAndNeighbors(grid, neighbor.loc);
+    size_t width = grid->dims.width;
+
+    revealCell(grid, &cell, loc);
+    Slice<size_t> revealed{arena->pushT<size_t>(loc.row * width + loc.col), 1};
+
+    for (size_t q = 0; q < revealed.len; ++q) {
+        size_t idx = revealed[q];
+        if (grid->cells[idx].number != 0) {
+            continue;
+        }
+
+        auto neighbor_op = Op<Grid::Neighbor>::empty();
+        auto neighbor_it = grid->neighborIterator(idx / width, idx % width);
+        while ((neighbor_op = neighbor_it.next()).valid) {
+            Grid::Neighbor neighbor = neighbor_op.get();
+            // a zero has no mines around it
+            if (neighbor.cell->display_type != CellDisplayType::cdt_hidden) {
+                continue;
             }
+
+            revealCell(grid, neighbor.cell, neighbor.loc);
+            arena->pushT<size_t>(neighbor.loc.row * width + neighbor.loc.col);
+            ++revealed.len;
         }
-    } break;
-    case ct_mine: {
-        // keep it hidden
-    } break;
     }
+
+    return revealed;
+}
+
+auto uncoverSelfAndNeighbors(Grid *grid, Location loc) -> void {
+    Cell &cell = (*grid)[loc];
+    if (cell.display_type != CellDisplayType::cdt_hidden ||
+        cell.type != CellType::ct_number) {
+        return;
+    }
+
+    // only a zero needs the queue
+    if (cell.number != 0) {
+        revealCell(grid, &cell, loc);
+        return;
+    }
+
+    assert(grid->scratch != nullptr && "Grid has no scratch arena");
+    auto mark = grid->scratch->mark();
+    uncoverRegion(grid->scratch, grid, loc);
 }
 
 auto uncoverSelfAndNeighbors(Grid *grid, Cell *cell) -> void {
@@ -98,46 +291,69 @@ auto uncoverSelfAndNeighbors(Grid *grid, Cell *cell) -> void {
     uncoverSelfAndNeighbors(grid, cell_loc);
 }
 
-auto generateGrid(Arena *arena, Dims dims, size_t mine_count,
-                  Location start_loc) -> Grid {
-    size_t cell_count = dims.area();
-    assert(cell_count > 0 && "Invalid dimensions");
-    assert(start_loc.row < dims.height && "Invalid start row");
-    assert(start_loc.col < dims.width && "Invalid start column");
-
-    size_t neighbor_count = neighborCount(start_loc, dims);
-    assert(mine_count < (cell_count - neighbor_count) && "Invalid mine count");
-
-    Cell *cells = arena->pushTN<Cell>(cell_count);
-    Grid grid{Slice<Cell>{cells, cell_count}, dims, mine_count};
-
-    // initialize cells
-    for (Cell &cell : grid.cells) {
-        cell = Cell{CellType::ct_number, CellDisplayType::cdt_hidden, 0, 0};
+// the player clicked a mine, show it so the game is lost
+auto uncoverMine(Grid *grid, Location loc) -> void {
+    Cell &cell = (*grid)[loc];
+    assert(cell.type == CellType::ct_mine && "Not a mine");
+    if (cell.display_type != CellDisplayType::cdt_hidden) {
+        return;
     }
+    journalChange(grid, loc, cell.display_type);
 
-    // fill mines
-    size_t remaining_mines = mine_count;
-    while (remaining_mines > 0) {
-        size_t ind = rand() % cell_count;
-        size_t row = ind / dims.width;
-        size_t col = ind % dims.width;
+    cell.display_type = CellDisplayType::cdt_value;
+    addHiddenNeighbor(grid, loc, -1);
+    ++grid->mines_revealed;
+}
 
-        Cell &cur = grid[row][col];
+// enough for the cells and the flood fill queue, and with GRID_BITBOARD for
+// the planes numberGrid counts on
+auto gridArenaSize(Dims dims) -> size_t {
+    size_t size = dims.area() * (sizeof(Cell) + sizeof(size_t)) + 64;
+#ifdef GRID_BITBOARD
+    size += 5 * Bitboard::planeSize(dims) + 64;
+#endif
+    return size;
+}
 
-        bool current_mine = cur.type == CellType::ct_mine;
-        bool current_start = row == start_loc.row && col == start_loc.col;
-        bool current_neighbor = isNeighbor(Location{row, col}, start_loc);
+// The first mine_count steps of a Fisher-Yates shuffle of the cells that may
+// hold a mine, so every mine takes one draw whatever the density. The list of
+// cells is popped again, uncovering the start needs the same space.
+static auto placeMines(Grid *grid, Location start_loc, Rng *rng) -> void {
+    Arena *arena = grid->scratch;
+    auto mark = arena->mark();
 
-        if (current_mine || current_start || current_neighbor) {
-            continue;
+    Dims dims = grid->dims;
+    size_t cell_count = dims.area();
+    size_t candidate_count = cell_count - neighborCount(start_loc, dims) - 1;
+
+    Slice<size_t> candidates{arena->pushTN<size_t>(candidate_count),
+                             candidate_count};
+    size_t len = 0;
+    for (size_t idx = 0; idx < cell_count; ++idx) {
+        Location loc{idx / dims.width, idx % dims.width};
+        if (!loc.eql(start_loc) && !isNeighbor(loc, start_loc)) {
+            candidates[len++] = idx;
         }
+    }
+    assert(len == candidate_count && "Miscounted mine candidates");
+
+    for (size_t i = 0; i < grid->mine_count; ++i) {
+        size_t j = i + randomBelow(rng, candidate_count - i);
+        size_t ind = candidates[j];
+        candidates[j] = candidates[i];
+        candidates[i] = ind;
 
+        Cell &cur = grid->cells[ind];
+
+        // a mine has no number, drop what earlier mines counted into it
         cur.type = CellType::ct_mine;
-        --remaining_mines;
+        cur.number = 0;
+        cur.eff_number = 0;
 
+#ifndef GRID_BITBOARD
         auto neighbor_op = Op<Grid::Neighbor>::empty();
-        auto neighbor_it = grid.neighborIterator(row, col);
+        auto neighbor_it =
+            grid->neighborIterator(ind / dims.width, ind % dims.width);
         while ((neighbor_op = neighbor_it.next()).valid) {
             Cell *cell = neighbor_op.get().cell;
             if (cell->type == CellType::ct_number) {
@@ -145,7 +361,43 @@ auto generateGrid(Arena *arena, Dims dims, size_t mine_count,
                 ++cell->eff_number;
             }
         }
+#endif
     }
+}
+
+auto generateGrid(Arena *arena, Dims dims, size_t mine_count,
+                  Location start_loc) -> Grid {
+    Rng rng = seedRng(rand());
+    return generateGrid(arena, dims, mine_count, start_loc, &rng);
+}
+
+// the same (dims, mine_count, start_loc) and rng state always give the same
+// grid, and separate states can be used from separate threads
+auto generateGrid(Arena *arena, Dims dims, size_t mine_count,
+                  Location start_loc, Rng *rng) -> Grid {
+    size_t cell_count = dims.area();
+    assert(cell_count > 0 && "Invalid dimensions");
+    assert(start_loc.row < dims.height && "Invalid start row");
+    assert(start_loc.col < dims.width && "Invalid start column");
+
+    size_t neighbor_count = neighborCount(start_loc, dims);
+    assert(mine_count < (cell_count - neighbor_count) && "Invalid mine count");
+
+    Cell *cells = arena->pushTN<Cell>(cell_count);
+    Grid grid{Slice<Cell>{cells, cell_count}, dims, mine_count};
+    grid.scratch = arena;
+
+    // initialize cells
+    for (Cell &cell : grid.cells) {
+        Location loc = grid.cellLocation(&cell);
+        cell = Cell{CellType::ct_number, CellDisplayType::cdt_hidden, 0, 0,
+                    (unsigned char)neighborCount(loc, dims)};
+    }
+
+    placeMines(&grid, start_loc, rng);
+#ifdef GRID_BITBOARD
+    numberGrid(&grid);
+#endif
 
     // uncover initial click
     uncoverSelfAndNeighbors(&grid, start_loc);
@@ -153,26 +405,32 @@ auto generateGrid(Arena *arena, Dims dims, size_t mine_count,
     return grid;
 }
 
-auto gridSolved(Grid grid) -> bool {
-    for (Cell cell : grid.cells) {
-        if (cell.type == CellType::ct_number &&
-            cell.display_type != CellDisplayType::cdt_value) {
-            return false;
-        }
+// every field goes into the key, so configs that differ anywhere give
+// unrelated boards for the same index
+auto boardKey(BoardConfig config) -> uint64_t {
+    uint64_t fields[] = {config.dims.width,    config.dims.height,
+                         config.mine_count,    config.start_loc.row,
+                         config.start_loc.col, config.seed};
+
+    uint64_t key = 0;
+    for (uint64_t field : fields) {
+        key = mix64(key ^ field) + 0x9e3779b97f4a7c15;
     }
-    return true;
+    return key;
 }
 
-auto gridLost(Grid grid) -> bool {
-    for (Cell cell : grid.cells) {
-        if (cell.display_type == CellDisplayType::cdt_value &&
-            cell.type == CellType::ct_mine) {
-            return true;
-        }
-    }
-    return false;
+auto generateBoard(Arena *arena, BoardConfig config, uint64_t index) -> Grid {
+    Rng rng = keyedRng(boardKey(config), index);
+    return generateGrid(arena, config.dims, config.mine_count,
+                        config.start_loc, &rng);
 }
 
+auto gridSolved(Grid grid) -> bool {
+    return grid.safe_revealed == grid.cells.len - grid.mine_count;
+}
+
+auto gridLost(Grid grid) -> bool { return grid.mines_revealed > 0; }
+
 auto losingCell(Grid grid) -> Location {
     for (Cell &cell : grid.cells) {
         if (cell.display_type == CellDisplayType::cdt_value &&
@@ -187,14 +445,78 @@ auto gridRemainingFlags(Grid grid) -> long {
     assert(grid.mine_count <= static_cast<size_t>(LONG_MAX) &&
            "Mine count exceeds long max");
 
-    long remaining = static_cast<long>(grid.mine_count);
-    for (auto &cell : grid.cells) {
-        if (cell.display_type == CellDisplayType::cdt_flag) {
-            remaining -= 1;
+    return static_cast<long>(grid.mine_count) -
+           static_cast<long>(grid.flags_placed);
+}
+
+auto splitGrid(Arena *arena, Grid grid) -> GridPlanes {
+    size_t cell_count = grid.cells.len;
+
+    GridPlanes planes{};
+    planes.truth = Slice<unsigned char>{
+        arena->pushTN<unsigned char>(cell_count), cell_count};
+    planes.display = Slice<unsigned char>{
+        arena->pushTN<unsigned char>(cell_count), cell_count};
+    planes.eff_number = Slice<unsigned char>{
+        arena->pushTN<unsigned char>(cell_count), cell_count};
+    planes.hidden_count = Slice<unsigned char>{
+        arena->pushTN<unsigned char>(cell_count), cell_count};
+    planes.dims = grid.dims;
+    planes.mine_count = grid.mine_count;
+
+    for (size_t idx = 0; idx < cell_count; ++idx) {
+        Cell cell = grid.cells[idx];
+
+        unsigned char truth = cell.number;
+        if (cell.type == CellType::ct_mine) {
+            truth |= GridPlanes::mine_bit;
+        }
+
+        planes.truth[idx] = truth;
+        planes.display[idx] = cell.display_type;
+        planes.eff_number[idx] = cell.eff_number;
+        planes.hidden_count[idx] = cell.hidden_count;
+    }
+
+    return planes;
+}
+
+auto joinGrid(Arena *arena, GridPlanes planes) -> Grid {
+    size_t cell_count = planes.truth.len;
+
+    Cell *cells = arena->pushTN<Cell>(cell_count);
+    Grid grid{Slice<Cell>{cells, cell_count}, planes.dims, planes.mine_count};
+    grid.scratch = arena;
+
+    for (size_t idx = 0; idx < cell_count; ++idx) {
+        unsigned char truth = planes.truth[idx];
+
+        Cell &cell = grid.cells[idx];
+        cell.type = (truth & GridPlanes::mine_bit) ? CellType::ct_mine
+                                                   : CellType::ct_number;
+        cell.display_type = (CellDisplayType)planes.display[idx];
+        cell.number = truth & ~GridPlanes::mine_bit;
+        cell.eff_number = planes.eff_number[idx];
+        cell.hidden_count = planes.hidden_count[idx];
+
+        switch (cell.display_type) {
+        case cdt_value: {
+            if (cell.type == CellType::ct_mine) {
+                ++grid.mines_revealed;
+            } else {
+                ++grid.safe_revealed;
+            }
+        } break;
+        case cdt_flag: {
+            ++grid.flags_placed;
+        } break;
+        case cdt_hidden:
+        case cdt_maybe_flag: {
+        } break;
         }
     }
 
-    return remaining;
+    return grid;
 }
 
 auto printCellValue(Cell cell) -> void {
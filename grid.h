@@ -3,27 +3,49 @@
 #include "arena.cc"
 #include "dirutils.cc"
 #include "op.cc"
+#include "random.cc"
 #include "slice.cc"
 
 #include <stddef.h>
 
-enum CellType {
+enum CellType : unsigned char {
     ct_number,
     ct_mine,
 };
 
-enum CellDisplayType {
+enum CellDisplayType : unsigned char {
     cdt_hidden,
     cdt_value,
     cdt_flag,
     cdt_maybe_flag,
 };
 
+// type, display type and number share the first byte, so a cell is 3 bytes
 struct Cell {
-    CellType type;
-    CellDisplayType display_type;
-    unsigned char number; // if type == number, the associated value (0-8)
+    CellType type : 1;
+    CellDisplayType display_type : 2;
+    unsigned char number : 4; // if type == number, the associated value (0-8)
     unsigned char eff_number;
+    unsigned char hidden_count; // neighbors with display_type == cdt_hidden
+};
+
+static_assert(sizeof(Cell) == 3, "Cell is expected to be packed");
+
+// An undo log for a grid. While a transaction is open every change the grid
+// functions make records the cell and what it showed before; the rest of a
+// change (the neighbors' hidden_count and eff_number, the grid's counters)
+// follows from the display types on either side of it. Rolling back undoes
+// the entries newest first, so it costs as much as the changes did and not a
+// pass over the grid.
+struct Journal {
+    struct Entry {
+        size_t idx;
+        CellDisplayType before;
+    };
+
+    Arena arena;
+    Slice<Entry> entries; // everything on arena, it is grown by copying
+    size_t depth;         // open transactions
 };
 
 struct Grid {
@@ -68,6 +90,19 @@ struct Grid {
     Dims dims;
     size_t mine_count;
 
+    // kept up to date by the functions that change cells, so the game state
+    // does not need a pass over the grid
+    size_t flags_placed;
+    size_t safe_revealed;
+    size_t mines_revealed;
+
+    // room for the queue of a flood fill, usually whatever the cells came
+    // from; nothing is left on it (see gridArenaSize)
+    Arena *scratch;
+
+    // nullptr unless changes are being recorded, see beginTransaction
+    Journal *journal;
+
     inline auto operator[](size_t row) -> Row {
         size_t row_s = (row + 0) * this->dims.width;
         size_t row_e = (row + 1) * this->dims.width;
@@ -104,14 +139,49 @@ struct Grid {
     }
 };
 
+// The same cells split into what is under them and what the player sees, for
+// passes that only need one of the two.
+struct GridPlanes {
+    static constexpr unsigned char mine_bit = 0x10;
+
+    Slice<unsigned char> truth;   // mine_bit or'd with the number
+    Slice<unsigned char> display; // display type
+    Slice<unsigned char> eff_number;
+    Slice<unsigned char> hidden_count;
+    Dims dims;
+    size_t mine_count;
+};
+
+// Everything a generated board depends on other than its index, board N of a
+// config is always the same grid no matter where or in what order it is made.
+struct BoardConfig {
+    Dims dims;
+    size_t mine_count;
+    Location start_loc;
+    uint64_t seed;
+};
+
+auto gridArenaSize(Dims dims) -> size_t;
 auto generateGrid(Arena *arena, Dims dims, size_t mine_count,
                   Location start_loc) -> Grid;
+auto generateGrid(Arena *arena, Dims dims, size_t mine_count,
+                  Location start_loc, Rng *rng) -> Grid;
+auto boardKey(BoardConfig config) -> uint64_t;
+auto generateBoard(Arena *arena, BoardConfig config, uint64_t index) -> Grid;
+auto makeJournal(size_t capacity) -> Journal;
+auto freeJournal(Journal *journal) -> void;
+auto beginTransaction(Grid *grid) -> size_t;
+auto commitTransaction(Grid *grid, size_t mark) -> void;
+auto rollbackTransaction(Grid *grid, size_t mark) -> void;
 auto resetGrid(Grid *grid) -> void;
+auto uncoverRegion(Arena *arena, Grid *grid, Location loc) -> Slice<size_t>;
 auto gridSolved(Grid grid) -> bool;
 auto gridLost(Grid grid) -> bool;
 auto losingCell(Grid grid) -> Location;
 auto gridRemainingFlags(Grid grid) -> long;
 auto printGrid(Grid grid, bool internal) -> void;
+auto splitGrid(Arena *arena, Grid grid) -> GridPlanes;
+auto joinGrid(Arena *arena, GridPlanes planes) -> Grid;
 
 #define FlagCellLocType(name, grid, loc)                                       \
     auto(name)(Grid * grid, Location loc) -> void
@@ -134,6 +204,16 @@ typedef UncoverSelfAndNeighborsLocType(UncoverSelfAndNeighborsLoc, grid, loc);
 typedef UncoverSelfAndNeighborsCellType(UncoverSelfAndNeighborsCell, grid,
                                         cell);
 
+#define UncoverRegionType(name, arena, grid, loc)                              \
+    auto(name)(Arena * arena, Grid * grid, Location loc) -> Slice<size_t>
+
+typedef UncoverRegionType(UncoverRegion, arena, grid, loc);
+
+#define CellChangedType(name, grid, loc, data)                                 \
+    auto(name)(Grid * grid, Location loc, void *data) -> void
+
+typedef CellChangedType(CellChanged, grid, loc, data);
+
 struct GridApi {
     FlagCellLoc *flagCellLoc;
     FlagCellCell *flagCellCell;
@@ -141,17 +221,73 @@ struct GridApi {
     UnflagCellCell *unflagCellCell;
     UncoverSelfAndNeighborsLoc *uncoverSelfAndNeighborsLoc;
     UncoverSelfAndNeighborsCell *uncoverSelfAndNeighborsCell;
+    UncoverRegion *uncoverRegionFn;
 
-    FlagCellLocType(flagCell, grid, loc) { this->flagCellLoc(grid, loc); }
-    FlagCellCellType(flagCell, grid, cell) { this->flagCellCell(grid, cell); }
-    UnflagCellLocType(unflagCell, grid, loc) { this->unflagCellLoc(grid, loc); }
+    // optional observer, told about every cell whose display type is changed
+    // through this api (nullptr when nobody is listening)
+    CellChanged *cellChanged;
+    void *listener;
+
+    FlagCellLocType(flagCell, grid, loc) {
+        CellDisplayType before = (*grid)[loc].display_type;
+        this->flagCellLoc(grid, loc);
+        this->notifyChanged(grid, loc, before);
+    }
+    FlagCellCellType(flagCell, grid, cell) {
+        CellDisplayType before = cell->display_type;
+        this->flagCellCell(grid, cell);
+        this->notifyChanged(grid, cell, before);
+    }
+    UnflagCellLocType(unflagCell, grid, loc) {
+        CellDisplayType before = (*grid)[loc].display_type;
+        this->unflagCellLoc(grid, loc);
+        this->notifyChanged(grid, loc, before);
+    }
     UnflagCellCellType(unflagCell, grid, cell) {
+        CellDisplayType before = cell->display_type;
         this->unflagCellCell(grid, cell);
+        this->notifyChanged(grid, cell, before);
     }
     UncoverSelfAndNeighborsLocType(uncoverSelfAndNeighbors, grid, loc) {
-        this->uncoverSelfAndNeighborsLoc(grid, loc);
+        if (this->cellChanged == nullptr) {
+            this->uncoverSelfAndNeighborsLoc(grid, loc);
+            return;
+        }
+
+        // a zero reveals a whole region, the listener hears about every cell
+        Arena *scratch = grid->scratch;
+        auto mark = scratch->mark();
+        Slice<size_t> revealed = this->uncoverRegionFn(scratch, grid, loc);
+        for (size_t idx : revealed) {
+            Location cell_loc{idx / grid->dims.width, idx % grid->dims.width};
+            this->cellChanged(grid, cell_loc, this->listener);
+        }
     }
     UncoverSelfAndNeighborsCellType(uncoverSelfAndNeighbors, grid, cell) {
-        this->uncoverSelfAndNeighborsCell(grid, cell);
+        if (this->cellChanged == nullptr) {
+            this->uncoverSelfAndNeighborsCell(grid, cell);
+            return;
+        }
+        this->uncoverSelfAndNeighbors(grid, grid->cellLocation(cell));
+    }
+
+    auto notifyChanged(Grid *grid, Location loc, CellDisplayType before)
+        -> void {
+        if (this->cellChanged == nullptr) {
+            return;
+        }
+        if ((*grid)[loc].display_type != before) {
+            this->cellChanged(grid, loc, this->listener);
+        }
+    }
+
+    auto notifyChanged(Grid *grid, Cell *cell, CellDisplayType before)
+        -> void {
+        if (this->cellChanged == nullptr) {
+            return;
+        }
+        if (cell->display_type != before) {
+            this->cellChanged(grid, grid->cellLocation(cell), this->listener);
+        }
     }
 };
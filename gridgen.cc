@@ -0,0 +1,269 @@
+#pragma once
+
+#include "grid.h"
+#include "solver.h"
+
+#include "arena.cc"
+#include "dirutils.cc"
+#include "grid.cc"
+#include "random.cc"
+#include "slice.cc"
+#include "solver.cc"
+#include "utils.cc"
+
+#include <assert.h>
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define SOLVER_SETUP(Name, arena, solver, data)                                \
+    auto(Name)(Arena * arena, GridSolver * solver, void *data) -> void
+#define SOLVER_TEARDOWN(Name, solver, data)                                    \
+    auto(Name)(GridSolver * solver, void *data) -> void
+
+typedef SOLVER_SETUP(SolverSetup, arena, solver, data);
+typedef SOLVER_TEARDOWN(SolverTeardown, solver, data);
+
+enum GeneratorStatus {
+    gs_idle,
+    gs_running,
+    gs_found,
+    gs_cancelled,
+};
+
+struct GeneratorProgress {
+    GeneratorStatus status;
+    size_t attempts;
+    double attempts_per_sec;
+    double elapsed_s;
+};
+
+// Generates candidate grids on every worker thread at once and keeps the first
+// one the solver can finish. Each worker owns its grid memory and its own
+// solver (and so its own rule state), only the counters and the result are
+// shared.
+struct SolvableGenerator {
+    struct Worker {
+        SolvableGenerator *gen;
+        pthread_t thread;
+        Arena rule_arena;
+        Arena grid_arena;
+        GridSolver solver;
+    };
+
+    SolverSetup *setup;
+    SolverTeardown *teardown;
+    void *data;
+    Slice<Worker> workers;
+
+    BoardConfig config;
+    uint64_t start_ns;
+    bool running;
+
+    std::atomic<bool> cancelled;
+    std::atomic<bool> found;
+    std::atomic<size_t> attempts;
+    // boards are handed out by index, so whichever worker takes one the
+    // board is the same and the winner can be regenerated from its index
+    std::atomic<uint64_t> next_index;
+
+    // only written by the worker that flips found
+    Arena result_arena;
+    Grid result;
+    uint64_t result_index;
+
+    static auto run(void *data) -> void * {
+        auto worker = static_cast<Worker *>(data);
+        worker->gen->work(worker);
+        return nullptr;
+    }
+
+    auto stopped() -> bool {
+        return this->cancelled.load(std::memory_order_relaxed) ||
+               this->found.load(std::memory_order_relaxed);
+    }
+
+    auto work(Worker *worker) -> void {
+        GridSolver &solver = worker->solver;
+
+        while (!this->stopped()) {
+            uint64_t index =
+                this->next_index.fetch_add(1, std::memory_order_relaxed);
+
+            worker->grid_arena.reset(0);
+            Grid grid = generateBoard(&worker->grid_arena, this->config, index);
+
+            // same as solvableFrom, but gives up as soon as another worker
+            // wins; grid is left at its first click for the result
+            Grid board = solver.startFrom(grid, this->config.start_loc);
+            while (!this->stopped() && solver.step(&board))
+                ;
+
+            bool solvable = !this->stopped() && gridSolved(board);
+            solver.resetEpoch(&board);
+            solver.state.invalid = true;
+
+            if (!this->stopped()) {
+                this->attempts.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            bool expected = false;
+            if (solvable && this->found.compare_exchange_strong(expected, true)) {
+                Slice<Cell> result_cells = this->result.cells;
+                for (size_t i = 0; i < grid.cells.len; ++i) {
+                    result_cells[i] = grid.cells[i];
+                }
+                this->result = grid;
+                this->result.cells = result_cells;
+                this->result.scratch = &this->result_arena;
+                this->result.journal = nullptr;
+                this->result_index = index;
+            }
+        }
+    }
+
+    static auto reserve(Arena *arena, size_t needed) -> void {
+        if (arena->cap < needed) {
+            if (arena->ptr != nullptr) {
+                freeArena(arena);
+            }
+            *arena = makeArena(needed);
+        }
+        arena->reset(0);
+    }
+};
+
+auto initGenerator(SolvableGenerator *gen, GridApi api, size_t worker_count,
+                   size_t rule_arena_size, SolverSetup *setup,
+                   SolverTeardown *teardown, void *data) -> void {
+    if (worker_count == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cores > 0 ? cores : 1;
+    }
+
+    gen->setup = setup;
+    gen->teardown = teardown;
+    gen->data = data;
+    gen->workers = Slice<SolvableGenerator::Worker>{
+        new SolvableGenerator::Worker[worker_count](), worker_count};
+    gen->running = false;
+
+    for (SolvableGenerator::Worker &worker : gen->workers) {
+        worker.gen = gen;
+        worker.rule_arena = makeArena(rule_arena_size);
+        initSolver(&worker.solver, api, SolveMode::sm_worklist);
+        setup(&worker.rule_arena, &worker.solver, data);
+    }
+}
+
+// tries the boards of config from first_index on, separate runs can split the
+// indices of one config between them
+auto startGenerator(SolvableGenerator *gen, BoardConfig config,
+                    uint64_t first_index) -> void {
+    assert(!gen->running && "Generator already running");
+
+    gen->config = config;
+
+    Dims dims = config.dims;
+    size_t cell_count = dims.area();
+    SolvableGenerator::reserve(&gen->result_arena, gridArenaSize(dims));
+    gen->result = Grid{Slice<Cell>{gen->result_arena.pushTN<Cell>(cell_count),
+                                   cell_count},
+                       dims, config.mine_count};
+    gen->result_index = 0;
+
+    gen->cancelled.store(false);
+    gen->found.store(false);
+    gen->attempts.store(0);
+    gen->next_index.store(first_index);
+    gen->start_ns = nanoTime();
+
+    for (SolvableGenerator::Worker &worker : gen->workers) {
+        SolvableGenerator::reserve(&worker.grid_arena, gridArenaSize(dims));
+
+        int err = pthread_create(&worker.thread, nullptr,
+                                 &SolvableGenerator::run, &worker);
+        if (err != 0) {
+            fprintf(stderr, "Failed to start generator thread (%d)\n", err);
+            EXIT(1);
+        }
+    }
+
+    gen->running = true;
+}
+
+auto joinGenerator(SolvableGenerator *gen) -> void {
+    if (!gen->running) {
+        return;
+    }
+
+    for (SolvableGenerator::Worker &worker : gen->workers) {
+        pthread_join(worker.thread, nullptr);
+    }
+    gen->running = false;
+}
+
+auto pollGenerator(SolvableGenerator *gen) -> GeneratorProgress {
+    GeneratorProgress progress{};
+
+    if (gen->found.load(std::memory_order_acquire)) {
+        progress.status = GeneratorStatus::gs_found;
+    } else if (gen->cancelled.load(std::memory_order_relaxed)) {
+        progress.status = GeneratorStatus::gs_cancelled;
+    } else if (gen->running) {
+        progress.status = GeneratorStatus::gs_running;
+    } else {
+        progress.status = GeneratorStatus::gs_idle;
+    }
+
+    progress.attempts = gen->attempts.load(std::memory_order_relaxed);
+    progress.elapsed_s = (nanoTime() - gen->start_ns) / 1e9;
+    if (progress.elapsed_s > 0) {
+        progress.attempts_per_sec = progress.attempts / progress.elapsed_s;
+    }
+
+    return progress;
+}
+
+auto cancelGenerator(SolvableGenerator *gen) -> void {
+    gen->cancelled.store(true);
+    joinGenerator(gen);
+}
+
+// copies the found grid out, the generator keeps its own copy until the next
+// start
+auto finishGenerator(SolvableGenerator *gen, Arena *arena) -> Grid {
+    joinGenerator(gen);
+    assert(gen->found.load() && "No grid was found");
+
+    Grid res = gen->result;
+    res.cells = Slice<Cell>{arena->pushTN<Cell>(res.cells.len), res.cells.len};
+    res.scratch = arena;
+    for (size_t i = 0; i < res.cells.len; ++i) {
+        res.cells[i] = gen->result.cells[i];
+    }
+
+    return res;
+}
+
+auto deinitGenerator(SolvableGenerator *gen) -> void {
+    cancelGenerator(gen);
+
+    for (SolvableGenerator::Worker &worker : gen->workers) {
+        gen->teardown(&worker.solver, gen->data);
+        deinitSolver(&worker.solver);
+
+        if (worker.grid_arena.ptr != nullptr) {
+            freeArena(&worker.grid_arena);
+        }
+        freeArena(&worker.rule_arena);
+    }
+    delete[] gen->workers.ptr;
+    gen->workers = Slice<SolvableGenerator::Worker>{nullptr, 0};
+
+    if (gen->result_arena.ptr != nullptr) {
+        freeArena(&gen->result_arena);
+    }
+}
@@ -0,0 +1,378 @@
+#include "grid.h"
+#include "solver.h"
+
+#include "arena.cc"
+#include "constraints.cc"
+#include "op.cc"
+#include "slice.cc"
+#include "strslice.cc"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Every revealed number is an equation: its hidden neighbors sum to its
+// effective number. The equations of each frontier component are row reduced,
+// with a row stored as one bitset of +1 and one of -1 coefficients. A row
+// whose value is at either end of the range its coefficients allow pins every
+// one of its cells.
+
+struct LinearRule {
+    struct Row {
+        uint64_t *pos;
+        uint64_t *neg;
+        size_t lo; // words outside [lo, hi) are zero
+        size_t hi;
+        long value;
+    };
+
+    static auto applyRule(Grid *grid, GridApi api, size_t row, size_t col,
+                          void *data) -> bool {
+        auto rule = static_cast<LinearRule *>(data);
+        return rule->apply(grid, api, row, col);
+    }
+
+    static auto onEpochStart(Grid *grid, GridApi, void *data) -> void {
+        auto rule = static_cast<LinearRule *>(data);
+        rule->onStart(grid);
+    }
+
+    Arena arena;
+    Arena scratch; // the rows of one component at a time
+    Dims dims;
+    size_t planes_end;
+
+    SeenPlane seen;
+    Slice<unsigned char> verdicts;
+
+    auto apply(Grid *grid, GridApi api, size_t row, size_t col) -> bool {
+        size_t idx = row * grid->dims.width + col;
+        if (idx >= this->verdicts.len) {
+            return false;
+        }
+
+        Cell &cell = (*grid)[row][col];
+        return applyVerdict(grid, api, &cell, (CellVerdict)this->verdicts[idx]);
+    }
+
+    auto onStart(Grid *grid) -> void {
+        if (this->dims.width != grid->dims.width ||
+            this->dims.height != grid->dims.height) {
+            this->reserve(grid->dims);
+        }
+
+        if (this->seen.extends(grid) &&
+            hasPendingVerdict(grid, this->verdicts)) {
+            return;
+        }
+        if (!this->seen.update(grid)) {
+            return;
+        }
+
+        this->arena.reset(this->planes_end);
+        for (unsigned char &verdict : this->verdicts) {
+            verdict = cv_unknown;
+        }
+
+        Frontier frontier = buildFrontier(&this->arena, grid);
+        if (frontier.lost) {
+            return;
+        }
+
+        for (Frontier::Component &comp : frontier.comps) {
+            this->reduce(grid, &frontier, &comp);
+        }
+    }
+
+    auto reserve(Dims dims) -> void {
+        size_t cell_count = dims.area();
+        size_t needed = cell_count + Frontier::arenaSize(cell_count) + 4096;
+
+        if (this->arena.cap < needed) {
+            if (this->arena.ptr != nullptr) {
+                freeArena(&this->arena);
+            }
+            this->arena = makeArena(needed);
+        }
+        this->arena.reset(0);
+
+        this->dims = dims;
+
+        this->seen.init(&this->arena, cell_count);
+        this->verdicts = Slice<unsigned char>{
+            this->arena.pushTN<unsigned char>(cell_count, cv_unknown),
+            cell_count};
+
+        this->planes_end = this->arena.len;
+    }
+
+    auto reserveScratch(size_t needed) -> void {
+        if (this->scratch.cap < needed) {
+            if (this->scratch.ptr != nullptr) {
+                freeArena(&this->scratch);
+            }
+            this->scratch = makeArena(needed);
+        }
+        this->scratch.reset(0);
+    }
+
+    auto reduce(Grid *grid, Frontier *frontier, Frontier::Component *comp)
+        -> void {
+        size_t var_count = comp->cells.len;
+        size_t row_count = comp->constraints.len;
+        size_t words = (var_count + 63) / 64;
+
+        this->reserveScratch(row_count * (sizeof(Row) + 2 * words * 8 +
+                                          sizeof(size_t)) +
+                             var_count * 2 * sizeof(size_t) + 64);
+
+        Slice<Row> rows{this->scratch.pushTN<Row>(row_count), row_count};
+        for (size_t r = 0; r < row_count; ++r) {
+            size_t con_idx = comp->constraints[r];
+            Row &row = rows[r];
+
+            row.pos = this->scratch.pushTN<uint64_t>(words, 0);
+            row.neg = this->scratch.pushTN<uint64_t>(words, 0);
+            row.lo = words;
+            row.hi = 0;
+            row.value = grid->cells[con_idx].eff_number;
+
+            auto var_op = Op<Grid::Neighbor>::empty();
+            auto var_it = grid->neighborIterator(con_idx / grid->dims.width,
+                                                 con_idx % grid->dims.width);
+            while ((var_op = var_it.next()).valid) {
+                Grid::Neighbor var = var_op.get();
+                if (!isUnknownCell(*var.cell)) {
+                    continue;
+                }
+
+                size_t var_idx = var.loc.row * grid->dims.width + var.loc.col;
+                size_t bit = frontier->var_of[var_idx];
+                size_t word = bit / 64;
+
+                row.pos[word] |= (uint64_t)1 << (bit % 64);
+                row.lo = word < row.lo ? word : row.lo;
+                row.hi = word + 1 > row.hi ? word + 1 : row.hi;
+            }
+        }
+
+        // forward elimination: rows are bucketed by their first cell, the
+        // first row in a bucket becomes that cell's pivot and the others are
+        // moved on to the bucket of whatever their first cell is afterwards
+        Slice<size_t> bucket{
+            this->scratch.pushTN<size_t>(var_count, Frontier::no_index),
+            var_count};
+        Slice<size_t> pivot_of{
+            this->scratch.pushTN<size_t>(var_count, Frontier::no_index),
+            var_count};
+        Slice<size_t> next{this->scratch.pushTN<size_t>(row_count), row_count};
+
+        for (size_t r = 0; r < row_count; ++r) {
+            this->pushBucket(bucket, next, rows, r);
+        }
+
+        for (size_t var = 0; var < var_count; ++var) {
+            size_t r = bucket[var];
+            if (r == Frontier::no_index) {
+                continue;
+            }
+
+            pivot_of[var] = r;
+            Row &pivot = rows[r];
+
+            size_t s = next[r];
+            while (s != Frontier::no_index) {
+                size_t s_next = next[s];
+
+                // a row that would need a coefficient of 2 stays as it is,
+                // it still takes part in the bounds check below
+                if (this->eliminate(&rows[s], pivot, var)) {
+                    this->pushBucket(bucket, next, rows, s);
+                }
+                s = s_next;
+            }
+        }
+
+        // back substitution, so each pivot row only keeps the cells no later
+        // pivot could take out; rows only reach a limited distance past
+        // their pivot which bounds how far back a cell can appear
+        size_t reach = 0;
+        for (size_t var = 0; var < var_count; ++var) {
+            if (pivot_of[var] != Frontier::no_index) {
+                size_t last = rows[pivot_of[var]].hi * 64;
+                reach = last - var > reach ? last - var : reach;
+            }
+        }
+
+        for (size_t var = var_count; var-- > 0;) {
+            if (pivot_of[var] == Frontier::no_index) {
+                continue;
+            }
+            Row &pivot = rows[pivot_of[var]];
+
+            for (size_t prev = var; prev-- > 0 && var - prev <= reach;) {
+                if (pivot_of[prev] == Frontier::no_index) {
+                    continue;
+                }
+
+                Row &row = rows[pivot_of[prev]];
+                if (this->eliminate(&row, pivot, var)) {
+                    size_t last = row.hi * 64;
+                    reach = last - prev > reach ? last - prev : reach;
+                }
+            }
+        }
+
+        for (Row &row : rows) {
+            this->pinRow(row, comp);
+        }
+    }
+
+    // subtracts (or adds) pivot from row so var drops out of it, returns
+    // false if var was not in row or the result is not a row of +-1s
+    auto eliminate(Row *row, Row &pivot, size_t var) -> bool {
+        size_t word = var / 64;
+        uint64_t bit = (uint64_t)1 << (var % 64);
+
+        if (word < row->lo || word >= row->hi) {
+            return false;
+        }
+
+        bool row_pos = row->pos[word] & bit;
+        bool row_neg = row->neg[word] & bit;
+        if (!row_pos && !row_neg) {
+            return false;
+        }
+
+        // subtract when the signs match, add the negated pivot otherwise
+        bool same_sign = row_pos == bool(pivot.pos[word] & bit);
+        uint64_t *sub_pos = same_sign ? pivot.pos : pivot.neg;
+        uint64_t *sub_neg = same_sign ? pivot.neg : pivot.pos;
+
+        for (size_t w = pivot.lo; w < pivot.hi; ++w) {
+            if ((row->pos[w] & sub_neg[w]) || (row->neg[w] & sub_pos[w])) {
+                return false;
+            }
+        }
+
+        for (size_t w = pivot.lo; w < pivot.hi; ++w) {
+            uint64_t p = row->pos[w];
+            uint64_t n = row->neg[w];
+
+            row->pos[w] = (p & ~sub_pos[w]) | (sub_neg[w] & ~n);
+            row->neg[w] = (n & ~sub_neg[w]) | (sub_pos[w] & ~p);
+        }
+
+        row->value += same_sign ? -pivot.value : pivot.value;
+        row->lo = pivot.lo < row->lo ? pivot.lo : row->lo;
+        row->hi = pivot.hi > row->hi ? pivot.hi : row->hi;
+
+        while (row->lo < row->hi &&
+               (row->pos[row->lo] | row->neg[row->lo]) == 0) {
+            ++row->lo;
+        }
+        while (row->hi > row->lo &&
+               (row->pos[row->hi - 1] | row->neg[row->hi - 1]) == 0) {
+            --row->hi;
+        }
+
+        return true;
+    }
+
+    auto pushBucket(Slice<size_t> bucket, Slice<size_t> next, Slice<Row> rows,
+                    size_t r) -> void {
+        Row &row = rows[r];
+        for (size_t w = row.lo; w < row.hi; ++w) {
+            uint64_t bits = row.pos[w] | row.neg[w];
+            if (bits != 0) {
+                size_t var = w * 64 + __builtin_ctzll(bits);
+                next[r] = bucket[var];
+                bucket[var] = r;
+                return;
+            }
+        }
+    }
+
+    auto pinRow(Row &row, Frontier::Component *comp) -> void {
+        long pos_count = 0;
+        long neg_count = 0;
+        for (size_t w = row.lo; w < row.hi; ++w) {
+            pos_count += __builtin_popcountll(row.pos[w]);
+            neg_count += __builtin_popcountll(row.neg[w]);
+        }
+
+        if (pos_count + neg_count == 0) {
+            return;
+        }
+
+        CellVerdict pos_verdict;
+        CellVerdict neg_verdict;
+        if (row.value == pos_count) {
+            pos_verdict = cv_mine;
+            neg_verdict = cv_safe;
+        } else if (row.value == -neg_count) {
+            pos_verdict = cv_safe;
+            neg_verdict = cv_mine;
+        } else {
+            return;
+        }
+
+        for (size_t w = row.lo; w < row.hi; ++w) {
+            this->pinBits(row.pos[w], w, pos_verdict, comp);
+            this->pinBits(row.neg[w], w, neg_verdict, comp);
+        }
+    }
+
+    auto pinBits(uint64_t bits, size_t word, CellVerdict verdict,
+                 Frontier::Component *comp) -> void {
+        while (bits != 0) {
+            size_t var = word * 64 + __builtin_ctzll(bits);
+            this->verdicts[comp->cells[var]] = verdict;
+            bits &= bits - 1;
+        }
+    }
+};
+
+auto makeLinear() -> LinearRule {
+    LinearRule rule{};
+    return rule;
+}
+
+auto deleteLinear(LinearRule *rule) -> void {
+    if (rule->arena.ptr != nullptr) {
+        freeArena(&rule->arena);
+    }
+    if (rule->scratch.ptr != nullptr) {
+        freeArena(&rule->scratch);
+    }
+    *rule = LinearRule{};
+}
+
+static StrSlice rule_name = STR_SLICE("linear");
+
+STATE_MAKER(makeState) {
+    LinearRule *internal = new LinearRule();
+    *internal = makeLinear();
+    return internal;
+}
+
+STATE_FREER(freeState, state) {
+    LinearRule *internal = (LinearRule *)state;
+    deleteLinear(internal);
+    delete internal;
+}
+
+REGISTERER(regRule, arena, solver, state) {
+    LinearRule *internal = (LinearRule *)state;
+
+    GridSolver::Rule rule =
+        GridSolver::Rule::from(LinearRule::applyRule, LinearRule::onEpochStart,
+                               nullptr, internal, rule_name);
+    rule.tier = RuleTier::rt_region;
+    solver->registerRule(arena, rule);
+}
+
+DEREGISTERER(deregRule, solver) {
+    return solver->deregisterRule(rule_name).data;
+}
+
+RulePlugin plugin{regRule, deregRule, makeState, freeState};
@@ -1,6 +1,5 @@
 #include "arena.cc"
 #include "dirutils.cc"
-#include "generated.cc"
 #include "graphics/bakedfont.cc"
 #include "graphics/common.cc"
 #include "graphics/containers.cc"
@@ -10,15 +9,15 @@
 #include "graphics/utils.cc"
 #include "graphics/window.cc"
 #include "grid.cc"
+#include "gridgen.cc"
 #include "linkedlist.cc"
-#include "one_of_aware.cc"
 #include "op.cc"
+#include "rules.cc"
 #include "slice.cc"
 #include "solver.cc"
 
 #include <GLFW/glfw3.h>
 #include <assert.h>
-#include <dlfcn.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,144 +25,6 @@
 
 #define LEN(arr) (sizeof(arr) / sizeof(*arr))
 
-static GridApi grid_api{
-    &flagCell,
-    &flagCell,
-    &unflagCell,
-    &unflagCell,
-    &uncoverSelfAndNeighbors,
-    &uncoverSelfAndNeighbors,
-};
-
-// local rules {{{1
-// flag_remaining_cells {{{2
-auto flag_remaining_cells(Grid *grid, GridApi api, size_t row, size_t col,
-                          void *) -> bool {
-    Cell cur = (*grid)[row][col];
-    if (cur.display_type != CellDisplayType::cdt_value ||
-        cur.type != CellType::ct_number) {
-        return false;
-    }
-
-    if (cur.eff_number == 0) {
-        return false;
-    }
-
-    size_t hidden_count = 0;
-
-    auto neighbor_op = Op<Grid::Neighbor>::empty();
-    auto neighbor_it = grid->neighborIterator(row, col);
-    while ((neighbor_op = neighbor_it.next()).valid) {
-        Cell *cell = neighbor_op.get().cell;
-        if (cell->display_type == CellDisplayType::cdt_hidden) {
-            ++hidden_count;
-        }
-    }
-
-    if (cur.eff_number == hidden_count) {
-        // flag all hidden cells
-        bool did_work = false;
-
-        auto neighbor_op = Op<Grid::Neighbor>::empty();
-        auto neighbor_it = grid->neighborIterator(row, col);
-        while ((neighbor_op = neighbor_it.next()).valid) {
-            Grid::Neighbor neighbor = neighbor_op.get();
-            Cell *cell = neighbor.cell;
-            if (cell->display_type == CellDisplayType::cdt_hidden) {
-                flagCell(grid, neighbor.loc);
-                did_work = true;
-            }
-        }
-        return did_work;
-    }
-
-    return false;
-};
-// }}}2
-
-// show_hidden_cells {{{2
-auto show_hidden_cells(Grid *grid, GridApi api, size_t row, size_t col, void *)
-    -> bool {
-    Cell cur = (*grid)[row][col];
-    if (cur.display_type != CellDisplayType::cdt_value ||
-        cur.type != CellType::ct_number) {
-        return false;
-    }
-
-    size_t mine_count = cur.number;
-    if (mine_count == 0) {
-        return false;
-    }
-
-    size_t eff_mine_count = cur.eff_number;
-    if (eff_mine_count == 0) {
-        // show all hidden cells
-        bool did_work = false;
-
-        auto neighbor_op = Op<Grid::Neighbor>::empty();
-        auto neighbor_it = grid->neighborIterator(row, col);
-        while ((neighbor_op = neighbor_it.next()).valid) {
-            Grid::Neighbor neighbor = neighbor_op.get();
-            Cell *cell = neighbor.cell;
-            if (cell->display_type == CellDisplayType::cdt_hidden) {
-                uncoverSelfAndNeighbors(grid, neighbor.loc);
-                did_work = true;
-            }
-        }
-        return did_work;
-    }
-
-    return false;
-}
-// }}}2
-
-// click remaining cells {{{2
-auto click_remaining_cells(Grid *grid, GridApi api, size_t row, size_t col,
-                           void *) -> bool {
-    long remainingFlags = gridRemainingFlags(*grid);
-    if (remainingFlags == 0) {
-        Cell &cell = (*grid)[row][col];
-        if (cell.display_type == CellDisplayType::cdt_hidden) {
-            uncoverSelfAndNeighbors(grid, &cell);
-            return true;
-        }
-    }
-    return false;
-}
-// }}}2
-// }}}1
-
-auto testGrid() -> void {
-    srand(0);
-
-    Arena grid_arena = makeArena(MEGABYTES(10));
-
-    Grid grid = generateGrid(&grid_arena, Dims{9, 18}, 34, Location{5, 5});
-
-    GridSolver::Rule flag_remaining_rule = GridSolver::Rule::from(
-        &flag_remaining_cells, STR_SLICE("flag_remaining_cells"));
-    GridSolver::Rule show_hidden_rule = GridSolver::Rule::from(
-        &show_hidden_cells, STR_SLICE("show_hidden_cells"));
-
-    GridSolver solver{};
-    initSolver(&solver, grid_api);
-
-    solver.registerRule(&grid_arena, flag_remaining_rule);
-    solver.registerRule(&grid_arena, show_hidden_rule);
-    registerPatterns(&grid_arena, &solver);
-
-    OneOfAwareRule one_of_aware_rule = makeOneOfAware(MEGABYTES(10));
-    registerRule(&grid_arena, &solver, &one_of_aware_rule);
-
-    bool is_solvable = solver.solvable(&grid);
-
-    printGrid(grid, false);
-    printf("The grid %s solvable\n", is_solvable ? "is" : "is not");
-
-    deleteOneOfAware(&one_of_aware_rule);
-    freeArena(&grid_arena);
-}
-
 void handle_error(int error, char const *description) {
     fprintf(stderr, "GLFW Error (%d)): %s\n", error, description);
 }
@@ -191,6 +52,7 @@ struct Context {
             et_lose_flame,
             et_continue_btn,
             et_restart_btn,
+            et_cancel_btn,
             et_empty_grid_cell,
             et_revealed_grid_cell,
             et_flagged_grid_cell,
@@ -293,6 +155,14 @@ struct Context {
     Grid grid;
     GridSolver solver;
 
+    Slice<RulePlugin *> plugins;
+    SolvableGenerator generator;
+    // the generator works on its own threads, the preview stays up until the
+    // grid it finds is swapped in by updateGenerator
+    bool generating;
+    BoardConfig generating_config;
+    GeneratorProgress generator_progress;
+
     bool did_step;
     size_t last_work_rule;
     bool last_step_success;
@@ -367,6 +237,10 @@ struct Context {
 
         SRect render_rect{render_loc, render_dims};
 
+        if (this->generating) {
+            this->updateGenerator();
+        }
+
         this->pushElement(Element::makeRectElement(Element::Type::et_background,
                                                    render_loc, render_dims));
 
@@ -440,6 +314,9 @@ struct Context {
 
         if (this->preview_grid) {
             this->buildPreviewGrid(grid_rect, cell_dims, cell_padding);
+            if (this->generating) {
+                this->buildGeneratingModal(render_rect);
+            }
             return;
         } else {
             this->buildGameGrid(grid_rect, cell_dims, cell_padding);
@@ -587,6 +464,58 @@ struct Context {
     }
     // }}}2
 
+    // build generating modal {{{2
+    auto buildGeneratingModal(SRect render_rect) -> void {
+        this->pushElement(
+            Element::makeRectElement(Element::Type::et_modal_background,
+                                     render_rect.ul, render_rect.dims));
+
+        size_t label_len = 48;
+        char *label = this->arena.pushTN<char>(label_len);
+        StrSlice generating_slice = sliceNPrintf(
+            label, label_len, "Generating... %zu attempts",
+            this->generator_progress.attempts);
+        StrSlice cancel_slice = STR_SLICE("Cancel");
+
+        Dims button_padding{10, 10};
+        Dims button_dims =
+            this->getButtonDims(cancel_slice, {}, button_padding);
+
+        VBox box{};
+        initVBox(&box, 10);
+
+        box.pushItem(&this->arena, this->getTextDims(generating_slice));
+        box.pushItem(&this->arena, button_dims);
+        SRect base_rect = centerIn(render_rect, box.getDims());
+
+        Dims min_modal_dims{render_rect.dims.width / 3,
+                            render_rect.dims.height / 3};
+
+        Dims modal_dims = expandToMin(min_modal_dims, base_rect.dims);
+        SLocation modal_loc = centerIn(render_rect, modal_dims).ul;
+
+        this->pushElement(Element::makeRectElement(
+            Element::Type::et_background, modal_loc, modal_dims));
+
+        VBox::LocIterator vbox_it = box.itemsIterator(base_rect.ul);
+
+        this->pushElement(Element::makeTextElement(
+            Element::Type::et_text, vbox_it.getNext().ul, generating_slice,
+            TEXT_COLOR));
+
+        SRect button_rect = vbox_it.getNext();
+        this->pushButtonAt(Element::Type::et_cancel_btn,
+                           centerIn(button_rect, button_dims).ul, cancel_slice,
+                           {}, button_padding);
+
+        assert(!vbox_it.hasNext());
+
+        // keep redrawing so the count moves and the grid is picked up
+        LLEvent *event = this->arena.pushT<LLEvent>({Event::et_animation});
+        this->ev_sentinel.enqueue(event);
+    }
+    // }}}2
+
     // build grid {{{2
     // build game grid {{{3
     auto buildGameGrid(SRect grid_rect, Dims cell_dims, size_t cell_padding)
@@ -689,16 +618,20 @@ struct Context {
         VBox footer_contents{};
         initVBox(&footer_contents, 20);
 
-        {
-            LinkedList<GridSolver::Rule> *ll = &this->solver.rule_sentinel;
-            while ((ll = ll->next) != &this->solver.rule_sentinel) {
-                Dims text_dims = this->getTextDims(ll->val.name);
-                Dims box_dims{text_dims.width + rule_used_dims.width,
-                              text_dims.height < rule_used_dims.height
-                                  ? rule_used_dims.height
-                                  : text_dims.height};
-                name_box.pushItem(&this->arena, box_dims);
-            }
+        size_t rule_count = this->solver.rules.len;
+        Slice<StrSlice> rule_labels{this->arena.pushTN<StrSlice>(rule_count),
+                                    rule_count};
+        for (size_t rule_idx = 0; rule_idx < rule_count; ++rule_idx) {
+            rule_labels[rule_idx] = this->ruleLabel(rule_idx);
+        }
+
+        for (StrSlice rule_label : rule_labels) {
+            Dims text_dims = this->getTextDims(rule_label);
+            Dims box_dims{text_dims.width + rule_used_dims.width,
+                          text_dims.height < rule_used_dims.height
+                              ? rule_used_dims.height
+                              : text_dims.height};
+            name_box.pushItem(&this->arena, box_dims);
         }
 
         footer_contents.pushItem(&this->arena,
@@ -725,11 +658,8 @@ struct Context {
 
         bool show_rule_used_mark = this->did_step && this->last_step_success;
 
-        LinkedList<GridSolver::Rule> *ll = &this->solver.rule_sentinel;
-        for (size_t rule_idx = 0; rule_idx < this->solver.rule_count;
+        for (size_t rule_idx = 0; rule_idx < this->solver.rules.len;
              ++rule_idx) {
-            ll = ll->next;
-
             SLocation name_box_loc = names_it.getNext().ul;
             SLocation name_loc{name_box_loc.row,
                                name_box_loc.col +
@@ -741,9 +671,9 @@ struct Context {
                                              rule_used_slice, rule_color));
             }
 
-            StrSlice rule_name = ll->val.name;
             this->pushElement(Element::makeTextElement(
-                Element::Type::et_text, name_loc, rule_name, rule_color));
+                Element::Type::et_text, name_loc, rule_labels[rule_idx],
+                rule_color));
         }
 
         if (this->did_step && !this->last_step_success) {
@@ -754,6 +684,24 @@ struct Context {
 
         assert(!names_it.hasNext());
     }
+
+    // the rule name, followed by its stats in a profiling build
+    auto ruleLabel(size_t rule_idx) -> StrSlice {
+        StrSlice rule_name = this->solver.ruleAt(rule_idx).name;
+
+        Op<RuleStats> stats_op = this->solver.ruleStats(rule_idx);
+        if (!stats_op.valid) {
+            return rule_name;
+        }
+
+        RuleStats stats = stats_op.get();
+        size_t label_len = rule_name.len + 64;
+        char *label = this->arena.pushTN<char>(label_len);
+        return sliceNPrintf(label, label_len,
+                            "%.*s  %zu/%zu calls, %zu cells, %.2fms",
+                            STR_ARGS(rule_name), stats.worked, stats.calls,
+                            stats.cells_changed, stats.ns / 1e6);
+    }
     // }}}2
 
     // build generate scene {{{2
@@ -984,6 +932,7 @@ struct Context {
             } break;
             case Element::Type::et_continue_btn:
             case Element::Type::et_restart_btn:
+            case Element::Type::et_cancel_btn:
             case Element::Type::et_generate_grid_btn:
             case Element::Type::et_step_solver_btn:
             case Element::Type::et_width_inc:
@@ -1014,6 +963,7 @@ struct Context {
         case Element::Type::et_modal_background:
         case Element::Type::et_continue_btn:
         case Element::Type::et_restart_btn:
+        case Element::Type::et_cancel_btn:
         case Element::Type::et_empty_grid_cell:
         case Element::Type::et_revealed_grid_cell:
         case Element::Type::et_flagged_grid_cell:
@@ -1072,6 +1022,30 @@ struct Context {
 
     auto paint(ThisWindow *window) -> void { renderScene(window); }
 
+    // swaps the found grid in for the preview, in one go on this thread, so
+    // nothing ever sees a half copied grid
+    auto updateGenerator() -> void {
+        this->generator_progress = pollGenerator(&this->generator);
+        if (this->generator_progress.status != GeneratorStatus::gs_found) {
+            return;
+        }
+
+        this->grid_arena.reset(0);
+        this->grid = finishGenerator(&this->generator, &this->grid_arena);
+        this->generating = false;
+        this->preview_grid = false;
+
+        this->solver.state.invalid = true;
+        this->solver.clearStats();
+
+        printf("Generated solvable grid after %zu attempts (%.1f/s), seed %llu "
+               "board %llu\n",
+               this->generator_progress.attempts,
+               this->generator_progress.attempts_per_sec,
+               (unsigned long long)this->generating_config.seed,
+               (unsigned long long)this->generator.result_index);
+    }
+
     auto processEvents(ThisWindow *window) -> void {
         LLEvent *ev = nullptr;
         while ((ev = this->ev_sentinel.dequeue()) != nullptr) {
@@ -1115,6 +1089,7 @@ struct Context {
                         case Element::Type::et_lose_flame:
                         case Element::Type::et_continue_btn:
                         case Element::Type::et_restart_btn:
+                        case Element::Type::et_cancel_btn:
                         case Element::Type::et_revealed_grid_cell:
                         case Element::Type::et_maybe_flagged_grid_cell:
                         case Element::Type::et_text:
@@ -1134,14 +1109,16 @@ struct Context {
                         case Element::Type::et_empty_grid_cell: {
                             input_consumed = true;
 
-                            flagCell(&this->grid, el->val.cell_loc);
+                            this->solver.api.flagCell(&this->grid,
+                                                      el->val.cell_loc);
 
                             window->needs_rerender = true;
                         } break;
                         case Element::Type::et_flagged_grid_cell: {
                             input_consumed = true;
 
-                            unflagCell(&this->grid, el->val.cell_loc);
+                            this->solver.api.unflagCell(&this->grid,
+                                                        el->val.cell_loc);
 
                             window->needs_rerender = true;
                         } break;
@@ -1173,8 +1150,7 @@ struct Context {
         case Element::Type::et_continue_btn: {
             *input_consumed = true;
 
-            Location cell_loc = el->val.cell_loc;
-            this->grid[cell_loc].display_type = CellDisplayType::cdt_flag;
+            this->solver.api.flagCell(&this->grid, el->val.cell_loc);
 
             window->needs_rerender = true;
         } break;
@@ -1189,6 +1165,18 @@ struct Context {
 
             window->needs_rerender = true;
         } break;
+        case Element::Type::et_cancel_btn: {
+            *input_consumed = true;
+
+            // the workers check between solver steps, so this is quick
+            cancelGenerator(&this->generator);
+            this->generating = false;
+
+            printf("Cancelled generation after %zu attempts\n",
+                   pollGenerator(&this->generator).attempts);
+
+            window->needs_rerender = true;
+        } break;
         case Element::Type::et_empty_grid_cell: {
             *input_consumed = true;
 
@@ -1197,45 +1185,42 @@ struct Context {
 
                 Dims grid_dims{this->width_input, this->height_input};
 
-                this->preview_grid = false;
-                this->grid = generateGrid(&this->grid_arena, grid_dims,
-                                          this->mine_input, el->val.cell_loc);
-
-                // NOTE(bhester): this hangs the UI as well if it cannot
-                // generate a solvable grid
                 if (this->generate_solvable_grid) {
-                    while (true) {
-                        bool solvable = this->solver.solvable(&this->grid);
-                        this->solver.reset(&this->grid);
-                        resetGrid(&this->grid);
-
-                        if (solvable) {
-                            // the reset grid above cleared this
-                            uncoverSelfAndNeighbors(&this->grid,
-                                                    el->val.cell_loc);
-
-                            break;
-                        }
-
-                        this->grid_arena.reset(0);
-                        this->grid =
-                            generateGrid(&this->grid_arena, grid_dims,
-                                         this->mine_input, el->val.cell_loc);
-                    }
+                    // the preview stays up (under a modal) until a grid is
+                    // found, see updateGenerator
+                    BoardConfig config{grid_dims, this->mine_input,
+                                       el->val.cell_loc, (uint64_t)rand()};
+                    startGenerator(&this->generator, config, 0);
+
+                    this->generating = true;
+                    this->generating_config = config;
+                    this->generator_progress = GeneratorProgress{};
+                } else {
+                    this->preview_grid = false;
+                    this->grid =
+                        generateGrid(&this->grid_arena, grid_dims,
+                                     this->mine_input, el->val.cell_loc);
+                    this->solver.state.invalid = true;
+                    this->solver.clearStats();
                 }
             } else {
                 Cell &cell = this->grid[el->val.cell_loc];
                 if (cell.type == CellType::ct_mine) {
                     // just set the cell as the value and we will render the
                     // mine and the "You Lose!" modal based on the fact that
-                    // this is showing
-                    cell.display_type = CellDisplayType::cdt_value;
+                    // this is showing; no rule uncovers a mine, so the api
+                    // has no call for it, but its listener still has to hear
+                    CellDisplayType before = cell.display_type;
+                    uncoverMine(&this->grid, el->val.cell_loc);
+                    this->solver.api.notifyChanged(&this->grid,
+                                                   el->val.cell_loc, before);
 
                     this->lose_animation_playing = true;
                     this->lose_animation_t = 0.0;
                     this->lose_animation_source = el->val.cell_loc;
                 } else {
-                    uncoverSelfAndNeighbors(&this->grid, el->val.cell_loc);
+                    this->solver.api.uncoverSelfAndNeighbors(&this->grid,
+                                                             el->val.cell_loc);
                 }
             }
 
@@ -1461,23 +1446,17 @@ auto initContext(Arena *arena, Window<Context> *window, Context *ctx,
     glFrontFace(GL_CCW);
     glClearColor(0.0, 0.0, 0.0, 0.0);
 
-    GridSolver::Rule flag_remaining_rule = GridSolver::Rule::from(
-        &flag_remaining_cells, STR_SLICE("flag_remaining_cells"));
-    GridSolver::Rule show_hidden_rule = GridSolver::Rule::from(
-        &show_hidden_cells, STR_SLICE("show_hidden_cells"));
-    GridSolver::Rule click_remaining_rule = GridSolver::Rule::from(
-        &click_remaining_cells, STR_SLICE("click_remaining_cells"));
-
-    initSolver(&ctx->solver, grid_api);
-    ctx->solver.registerRule(arena, flag_remaining_rule);
-    ctx->solver.registerRule(arena, show_hidden_rule);
-    ctx->solver.registerRule(arena, click_remaining_rule);
-    registerPatterns(arena, &ctx->solver);
-    for (auto plugin : plugins) {
-        plugin->regRule(arena, &ctx->solver);
-    }
+    initSolver(&ctx->solver, grid_api, SolveMode::sm_worklist);
+    registerRules(arena, &ctx->solver, plugins);
+
+    // one worker per core, each with its own copy of the rules
+    ctx->plugins = plugins;
+    initGenerator(&ctx->generator, grid_api, 0, 64 * 1024,
+                  &setupGeneratorSolver, &teardownGeneratorSolver,
+                  &ctx->plugins);
 
-    ctx->grid_arena = arena->subarena(KILOBYTES(4)); // pull out 4K
+    // the largest grid the inputs allow
+    ctx->grid_arena = arena->subarena(gridArenaSize(Dims{99, 99}));
     ctx->arena = arena->subarena(0);                 // and use the rest here
 
     ctx->quad_program = window->makeBaseQuadProgram(&ctx->arena);
@@ -1496,6 +1475,7 @@ auto initContext(Arena *arena, Window<Context> *window, Context *ctx,
     ctx->height_input = 10;
     ctx->mine_input = 15;
     ctx->generate_solvable_grid = true;
+    ctx->generating = false;
 
     ctx->did_step = false;
     ctx->last_work_rule = 0;
@@ -1529,37 +1509,22 @@ auto deinitContext(Context *ctx, Slice<RulePlugin *> plugins) -> void {
     deleteTexture(&ctx->disabled_button);
     deleteTexture(&ctx->button);
 
-    for (auto plugin : plugins) {
-        plugin->deregRule(&ctx->solver);
-    }
-    deregisterPatterns(&ctx->solver);
+    deinitGenerator(&ctx->generator);
+
+    deregisterRules(&ctx->solver, plugins);
+    deinitSolver(&ctx->solver);
 }
 
 int main() {
     Arena arena = makeArena(MEGABYTES(10));
 
-    void *handle = dlopen(SO("./one_of_aware"), RTLD_NOW);
-    if (handle == nullptr) {
-        fprintf(stderr, "Failed to open object: %s\n", dlerror());
-        EXIT(1);
-    }
-
-    RulePlugin *plugin = (RulePlugin *)dlsym(handle, "plugin");
-    if (plugin == nullptr) {
-        fprintf(stderr, "Failed to find sym: %p\n", (void *)plugin);
-        EXIT(1);
-    }
+    Slice<RulePlugin *> plugin_slice = loadRulePlugins();
 
     initGLFW(&handle_error);
 
     Window<Context> window{};
     initWindow(&arena, &window, 800, 600, "Hello, world");
 
-    RulePlugin *plugins[] = {plugin};
-    Slice<RulePlugin *> plugin_slice = SLICE(RulePlugin *, plugins);
-
-    loadPatternPlugins();
-
     initContext(&arena, &window, &window.ctx, plugin_slice);
     window.setPos(500, 500);
     window.show();
@@ -1594,7 +1559,6 @@ int main() {
     freeArena(&arena);
     glfwTerminate();
 
-    unloadPatternPlugins();
-    dlclose(handle);
+    unloadRulePlugins();
     return 0;
 }
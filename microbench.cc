@@ -0,0 +1,668 @@
+#include "grid.h"
+#include "solver.h"
+
+#include "arena.cc"
+#include "bitboard.cc"
+#include "dirutils.cc"
+#include "grid.cc"
+#include "rules.cc"
+#include "slice.cc"
+#include "solver.cc"
+#include "strslice.cc"
+#include "utils.cc"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Times the generator, the flood fill, rolling it back, the planes and bitboard
+// layouts and every registered rule on their own, over a fixed corpus of
+// boards, and writes or compares against a baseline.
+//
+// Rules are timed one at a time over snapshots of each board: right after the
+// first click and halfway through a solve. Every pass starts from a fresh copy
+// of the snapshot, and a rule's epoch start is part of its time.
+
+struct MicroOptions {
+    BoardConfig config;
+    size_t boards;
+    size_t reps;
+    char const *write_path;
+    char const *compare_path;
+    double threshold; // percent
+};
+
+struct Measurement {
+    char name[128];
+    size_t calls;  // per rep
+    size_t cells;  // per rep
+    size_t worked; // calls that changed the grid, per rep
+    uint64_t best_ns;
+};
+
+struct Corpus {
+    Slice<Grid> snapshots;
+    Grid work; // the copy a pass runs on
+};
+
+static auto copyGrid(Grid *dst, Grid src) -> void {
+    Slice<Cell> cells = dst->cells;
+    Arena *scratch = dst->scratch;
+    for (size_t i = 0; i < src.cells.len; ++i) {
+        cells[i] = src.cells[i];
+    }
+
+    *dst = src;
+    dst->cells = cells;
+    dst->scratch = scratch;
+}
+
+static auto pushGrid(Arena *arena, Grid src) -> Grid {
+    Grid grid = src;
+    grid.cells = Slice<Cell>{arena->pushTN<Cell>(src.cells.len), src.cells.len};
+    grid.scratch = arena;
+    copyGrid(&grid, src);
+    return grid;
+}
+
+static auto makeCorpus(Arena *arena, MicroOptions *opts, GridSolver *solver)
+    -> Corpus {
+    Corpus corpus{};
+    size_t snapshot_count = 2 * opts->boards;
+    corpus.snapshots = Slice<Grid>{arena->pushTN<Grid>(snapshot_count), 0};
+
+    for (size_t index = 0; index < opts->boards; ++index) {
+        Grid board = generateBoard(arena, opts->config, index);
+        corpus.snapshots.ptr[corpus.snapshots.len++] = board;
+
+        Grid half = pushGrid(arena, board);
+        size_t steps = 0;
+        solver->reset(&half);
+        while (solver->step(&half)) {
+            ++steps;
+        }
+        solver->resetEpoch(&half);
+
+        copyGrid(&half, board);
+        solver->reset(&half);
+        for (size_t i = 0; i < steps / 2 && solver->step(&half); ++i)
+            ;
+        solver->resetEpoch(&half);
+
+        corpus.snapshots.ptr[corpus.snapshots.len++] = half;
+    }
+
+    corpus.work = pushGrid(arena, corpus.snapshots[0]);
+    return corpus;
+}
+
+static auto benchGenerate(Arena *arena, MicroOptions *opts) -> Measurement {
+    Measurement m{};
+    snprintf(m.name, sizeof(m.name), "generateGrid");
+    m.best_ns = UINT64_MAX;
+
+    for (size_t rep = 0; rep < opts->reps; ++rep) {
+        uint64_t total_ns = 0;
+        for (size_t index = 0; index < opts->boards; ++index) {
+            arena->reset(0);
+            uint64_t start_ns = nanoTime();
+            generateBoard(arena, opts->config, index);
+            total_ns += nanoTime() - start_ns;
+        }
+        m.best_ns = total_ns < m.best_ns ? total_ns : m.best_ns;
+    }
+
+    m.calls = opts->boards;
+    m.cells = opts->boards * opts->config.dims.area();
+    m.worked = opts->boards;
+    return m;
+}
+
+static auto allHidden(Grid *grid) -> bool {
+    for (Cell &cell : grid->cells) {
+        Location loc = grid->cellLocation(&cell);
+        if (cell.display_type != CellDisplayType::cdt_hidden ||
+            cell.hidden_count != neighborCount(loc, grid->dims)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the first click of every board again, from all hidden
+static auto benchUncover(Corpus *corpus, MicroOptions *opts) -> Measurement {
+    Measurement m{};
+    snprintf(m.name, sizeof(m.name), "uncoverSelfAndNeighbors");
+    m.best_ns = UINT64_MAX;
+
+    Location start_loc = opts->config.start_loc;
+    for (size_t rep = 0; rep < opts->reps; ++rep) {
+        uint64_t total_ns = 0;
+        size_t revealed = 0;
+        for (size_t i = 0; i < corpus->snapshots.len; i += 2) {
+            copyGrid(&corpus->work, corpus->snapshots[i]);
+            resetGrid(&corpus->work);
+
+            uint64_t start_ns = nanoTime();
+            uncoverSelfAndNeighbors(&corpus->work, start_loc);
+            total_ns += nanoTime() - start_ns;
+
+            revealed += corpus->work.safe_revealed;
+        }
+        m.best_ns = total_ns < m.best_ns ? total_ns : m.best_ns;
+        m.cells = revealed;
+    }
+
+    m.calls = opts->boards;
+    m.worked = opts->boards;
+    return m;
+}
+
+// the first click of every board again, taken back by rolling back the
+// transaction it was made in; the grid has to come back all hidden
+static auto benchRollback(Corpus *corpus, MicroOptions *opts) -> Measurement {
+    Measurement m{};
+    snprintf(m.name, sizeof(m.name), "rollbackTransaction");
+    m.best_ns = UINT64_MAX;
+
+    Grid *grid = &corpus->work;
+    Journal journal = makeJournal(0);
+    Location start_loc = opts->config.start_loc;
+    for (size_t rep = 0; rep < opts->reps; ++rep) {
+        uint64_t total_ns = 0;
+        size_t undone = 0;
+        for (size_t i = 0; i < corpus->snapshots.len; i += 2) {
+            copyGrid(grid, corpus->snapshots[i]);
+            resetGrid(grid);
+            grid->journal = &journal;
+
+            size_t mark = beginTransaction(grid);
+            uncoverSelfAndNeighbors(grid, start_loc);
+            undone += journal.entries.len - mark;
+
+            uint64_t start_ns = nanoTime();
+            rollbackTransaction(grid, mark);
+            total_ns += nanoTime() - start_ns;
+
+            grid->journal = nullptr;
+            if (grid->safe_revealed != 0 || grid->mines_revealed != 0 ||
+                grid->flags_placed != 0 || !allHidden(grid)) {
+                fprintf(stderr, "Rollback left board %zu changed\n", i / 2);
+                EXIT(1);
+            }
+        }
+        m.best_ns = total_ns < m.best_ns ? total_ns : m.best_ns;
+        m.cells = undone;
+    }
+    freeJournal(&journal);
+
+    m.calls = opts->boards;
+    m.worked = opts->boards;
+    return m;
+}
+
+// every field of every cell and the counters the grid keeps over them
+static auto sameGrid(Grid lhs, Grid rhs) -> bool {
+    if (lhs.cells.len != rhs.cells.len || lhs.mine_count != rhs.mine_count ||
+        lhs.flags_placed != rhs.flags_placed ||
+        lhs.safe_revealed != rhs.safe_revealed ||
+        lhs.mines_revealed != rhs.mines_revealed) {
+        return false;
+    }
+
+    for (size_t idx = 0; idx < lhs.cells.len; ++idx) {
+        Cell a = lhs.cells[idx];
+        Cell b = rhs.cells[idx];
+        if (a.type != b.type || a.display_type != b.display_type ||
+            a.number != b.number || a.eff_number != b.eff_number ||
+            a.hidden_count != b.hidden_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// every snapshot out to planes and back, which has to give it back unchanged
+static auto benchSplitJoin(Corpus *corpus, MicroOptions *opts, Arena *arena)
+    -> Measurement {
+    Measurement m{};
+    snprintf(m.name, sizeof(m.name), "splitGrid+joinGrid");
+    m.best_ns = UINT64_MAX;
+
+    for (size_t rep = 0; rep < opts->reps; ++rep) {
+        uint64_t total_ns = 0;
+        for (size_t i = 0; i < corpus->snapshots.len; ++i) {
+            Grid snapshot = corpus->snapshots[i];
+            arena->reset(0);
+
+            uint64_t start_ns = nanoTime();
+            GridPlanes planes = splitGrid(arena, snapshot);
+            Grid joined = joinGrid(arena, planes);
+            total_ns += nanoTime() - start_ns;
+
+            if (!sameGrid(joined, snapshot)) {
+                fprintf(stderr, "Planes changed snapshot %zu\n", i);
+                EXIT(1);
+            }
+        }
+        m.best_ns = total_ns < m.best_ns ? total_ns : m.best_ns;
+    }
+
+    m.calls = corpus->snapshots.len;
+    m.cells = m.calls * opts->config.dims.area();
+    m.worked = m.calls;
+    return m;
+}
+
+// A pass that only looks at what the player sees, counting the hidden cells
+// of every snapshot, once over the cells and once over the display plane; the
+// planes are split off before the clock starts.
+static auto benchScanHidden(Corpus *corpus, MicroOptions *opts, Arena *arena,
+                            bool planes) -> Measurement {
+    Measurement m{};
+    snprintf(m.name, sizeof(m.name), "scanHidden(%s)",
+             planes ? "planes" : "cells");
+    m.best_ns = UINT64_MAX;
+
+    for (size_t rep = 0; rep < opts->reps; ++rep) {
+        uint64_t total_ns = 0;
+        size_t hidden = 0;
+        for (Grid snapshot : corpus->snapshots) {
+            arena->reset(0);
+            Slice<unsigned char> display = splitGrid(arena, snapshot).display;
+
+            uint64_t start_ns = nanoTime();
+            if (planes) {
+                for (unsigned char type : display) {
+                    hidden += type == CellDisplayType::cdt_hidden;
+                }
+            } else {
+                for (Cell &cell : snapshot.cells) {
+                    hidden += cell.display_type == CellDisplayType::cdt_hidden;
+                }
+            }
+            total_ns += nanoTime() - start_ns;
+        }
+        m.best_ns = total_ns < m.best_ns ? total_ns : m.best_ns;
+        m.worked = hidden;
+    }
+
+    m.calls = corpus->snapshots.len;
+    m.cells = m.calls * opts->config.dims.area();
+    return m;
+}
+
+// every snapshot to a bitboard and back, which has to give it back unchanged
+static auto benchBitboard(Corpus *corpus, MicroOptions *opts, Arena *arena)
+    -> Measurement {
+    Measurement m{};
+    snprintf(m.name, sizeof(m.name), "bitboardRoundTrip");
+    m.best_ns = UINT64_MAX;
+
+    for (size_t rep = 0; rep < opts->reps; ++rep) {
+        uint64_t total_ns = 0;
+        for (size_t i = 0; i < corpus->snapshots.len; ++i) {
+            Grid snapshot = corpus->snapshots[i];
+            arena->reset(0);
+
+            uint64_t start_ns = nanoTime();
+            Bitboard board = bitboardFromGrid(arena, snapshot);
+            Grid back = gridFromBitboard(arena, board);
+            total_ns += nanoTime() - start_ns;
+
+            if (!sameGrid(back, snapshot)) {
+                fprintf(stderr, "Bitboard changed snapshot %zu\n", i);
+                EXIT(1);
+            }
+        }
+        m.best_ns = total_ns < m.best_ns ? total_ns : m.best_ns;
+    }
+
+    m.calls = corpus->snapshots.len;
+    m.cells = m.calls * opts->config.dims.area();
+    m.worked = m.calls;
+    return m;
+}
+
+// The mines around every cell of every snapshot, once with countNeighbors
+// over the mine plane and once walking each cell's neighbors; the counts of
+// the two have to agree. The plane is made before the clock starts.
+static auto benchCountMines(Corpus *corpus, MicroOptions *opts, Arena *arena,
+                            bool planes) -> Measurement {
+    Measurement m{};
+    snprintf(m.name, sizeof(m.name), "%s",
+             planes ? "countNeighbors" : "NeighborIterator");
+    m.best_ns = UINT64_MAX;
+
+    Dims dims = opts->config.dims;
+    for (size_t rep = 0; rep < opts->reps; ++rep) {
+        uint64_t total_ns = 0;
+        size_t mines = 0;
+        for (size_t i = 0; i < corpus->snapshots.len; ++i) {
+            Grid snapshot = corpus->snapshots[i];
+            arena->reset(0);
+            Bitboard board = bitboardFromGrid(arena, snapshot);
+            Slice<unsigned char> counts{
+                arena->pushTN<unsigned char>(dims.area(), 0), dims.area()};
+
+            uint64_t start_ns = nanoTime();
+            if (planes) {
+                BitCounts bits = countNeighbors(arena, dims, board.mines);
+                total_ns += nanoTime() - start_ns;
+
+                for (size_t idx = 0; idx < counts.len; ++idx) {
+                    counts[idx] = bits.at(idx / dims.width, idx % dims.width);
+                }
+            } else {
+                for (size_t idx = 0; idx < counts.len; ++idx) {
+                    auto neighbor_op = Op<Grid::Neighbor>::empty();
+                    auto neighbor_it = snapshot.neighborIterator(
+                        idx / dims.width, idx % dims.width);
+                    while ((neighbor_op = neighbor_it.next()).valid) {
+                        counts[idx] += (*neighbor_op.get().cell).type ==
+                                       CellType::ct_mine;
+                    }
+                }
+                total_ns += nanoTime() - start_ns;
+            }
+
+            for (size_t idx = 0; idx < counts.len; ++idx) {
+                Cell cell = snapshot.cells[idx];
+                if (cell.type == CellType::ct_number &&
+                    counts[idx] != cell.number) {
+                    fprintf(stderr, "%s miscounted snapshot %zu\n", m.name,
+                            i);
+                    EXIT(1);
+                }
+                mines += counts[idx];
+            }
+        }
+        m.best_ns = total_ns < m.best_ns ? total_ns : m.best_ns;
+        m.worked = mines;
+    }
+
+    m.calls = corpus->snapshots.len;
+    m.cells = m.calls * dims.area();
+    return m;
+}
+
+static auto benchRule(Corpus *corpus, MicroOptions *opts,
+                      GridSolver::Rule *rule) -> Measurement {
+    Measurement m{};
+    snprintf(m.name, sizeof(m.name), "%.*s", STR_ARGS(rule->name));
+    m.best_ns = UINT64_MAX;
+
+    Grid *grid = &corpus->work;
+    for (size_t rep = 0; rep < opts->reps; ++rep) {
+        uint64_t total_ns = 0;
+        size_t calls = 0;
+        size_t worked = 0;
+        for (Grid snapshot : corpus->snapshots) {
+            copyGrid(grid, snapshot);
+
+            uint64_t start_ns = nanoTime();
+            rule->onEpochStart(grid, grid_api);
+            for (size_t row = 0; row < grid->dims.height; ++row) {
+                for (size_t col = 0; col < grid->dims.width; ++col) {
+                    worked += rule->applyRule(grid, grid_api, row, col);
+                }
+            }
+            rule->onEpochFinish(grid, grid_api);
+            total_ns += nanoTime() - start_ns;
+
+            calls += grid->dims.area();
+        }
+        m.best_ns = total_ns < m.best_ns ? total_ns : m.best_ns;
+        m.calls = calls;
+        m.worked = worked;
+    }
+
+    m.cells = m.calls;
+    return m;
+}
+
+static auto nsPerCall(Measurement m) -> double {
+    return m.calls > 0 ? (double)m.best_ns / m.calls : 0;
+}
+
+static auto nsPerCell(Measurement m) -> double {
+    return m.cells > 0 ? (double)m.best_ns / m.cells : 0;
+}
+
+static auto printMeasurements(Slice<Measurement> measurements) -> void {
+    printf("%-32s %10s %10s %12s %12s\n", "component", "calls", "worked",
+           "ns/call", "ns/cell");
+    for (Measurement &m : measurements) {
+        printf("%-32s %10zu %10zu %12.1f %12.2f\n", m.name, m.calls, m.worked,
+               nsPerCall(m), nsPerCell(m));
+    }
+}
+
+static auto writeBaseline(char const *path, Slice<Measurement> measurements)
+    -> void {
+    FILE *file = fopen(path, "w");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open %s for writing\n", path);
+        EXIT(1);
+    }
+
+    fprintf(file, "component,calls,worked,ns_per_call,ns_per_cell\n");
+    for (Measurement &m : measurements) {
+        fprintf(file, "%s,%zu,%zu,%.3f,%.4f\n", m.name, m.calls, m.worked,
+                nsPerCall(m), nsPerCell(m));
+    }
+
+    fclose(file);
+}
+
+// returns the number of regressions, components missing on either side are
+// reported but do not count
+static auto compareBaseline(char const *path, Slice<Measurement> measurements,
+                            double threshold) -> size_t {
+    FILE *file = fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        EXIT(1);
+    }
+
+    printf("%-32s %12s %12s %9s\n", "component", "base ns/call",
+           "ns/call", "change");
+
+    size_t regressions = 0;
+    size_t matched = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        char name[128];
+        size_t calls, worked;
+        double base_ns, base_cell_ns;
+        if (sscanf(line, "%127[^,],%zu,%zu,%lf,%lf", name, &calls, &worked,
+                   &base_ns, &base_cell_ns) != 5) {
+            continue; // the header
+        }
+
+        Measurement *cur = nullptr;
+        for (Measurement &m : measurements) {
+            if (strcmp(m.name, name) == 0) {
+                cur = &m;
+                break;
+            }
+        }
+        if (cur == nullptr) {
+            printf("%-32s %12.1f %12s\n", name, base_ns, "missing");
+            continue;
+        }
+        ++matched;
+
+        double now_ns = nsPerCall(*cur);
+        double change = base_ns > 0 ? 100.0 * (now_ns - base_ns) / base_ns : 0;
+        bool regressed = change > threshold;
+        regressions += regressed;
+
+        printf("%-32s %12.1f %12.1f %+8.1f%%%s\n", name, base_ns, now_ns,
+               change, regressed ? "  REGRESSION" : "");
+        if (cur->calls != calls || cur->worked != worked) {
+            printf("%-32s calls %zu/%zu worked %zu/%zu, corpus differs\n", "",
+                   calls, cur->calls, worked, cur->worked);
+        }
+    }
+    fclose(file);
+
+    if (matched < measurements.len) {
+        printf("%zu components are not in the baseline\n",
+               measurements.len - matched);
+    }
+    printf("%zu regressions beyond %.1f%%\n", regressions, threshold);
+
+    return regressions;
+}
+
+static auto usage(char const *prog) -> void {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --width N         grid width (30)\n"
+            "  --height N        grid height (16)\n"
+            "  --mines N         mine count (99)\n"
+            "  --seed N          board config seed (0)\n"
+            "  --boards N        boards in the corpus (100)\n"
+            "  --reps N          passes per component, the best counts (5)\n"
+            "  --write FILE      write the results as a baseline\n"
+            "  --compare FILE    compare against a baseline\n"
+            "  --threshold PCT   slowdown that counts as a regression (10)\n",
+            prog);
+}
+
+static auto parseNumber(char const *prog, char const *flag, char const *arg)
+    -> uint64_t {
+    uint64_t value;
+    if (!parseU64(arg, &value)) {
+        fprintf(stderr, "Invalid value for %s: %s\n", flag,
+                arg != nullptr ? arg : "(none)");
+        usage(prog);
+        EXIT(1);
+    }
+    return value;
+}
+
+static auto parseOptions(int argc, char **argv) -> MicroOptions {
+    MicroOptions opts{};
+    opts.config.dims = Dims{30, 16};
+    opts.config.mine_count = 99;
+    opts.boards = 100;
+    opts.reps = 5;
+    opts.threshold = 10;
+
+    for (int i = 1; i < argc; ++i) {
+        char const *flag = argv[i];
+        char const *arg = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (strcmp(flag, "--width") == 0) {
+            opts.config.dims.width = parseNumber(argv[0], flag, arg);
+        } else if (strcmp(flag, "--height") == 0) {
+            opts.config.dims.height = parseNumber(argv[0], flag, arg);
+        } else if (strcmp(flag, "--mines") == 0) {
+            opts.config.mine_count = parseNumber(argv[0], flag, arg);
+        } else if (strcmp(flag, "--seed") == 0) {
+            opts.config.seed = parseNumber(argv[0], flag, arg);
+        } else if (strcmp(flag, "--boards") == 0) {
+            opts.boards = parseNumber(argv[0], flag, arg);
+        } else if (strcmp(flag, "--reps") == 0) {
+            opts.reps = parseNumber(argv[0], flag, arg);
+        } else if (strcmp(flag, "--threshold") == 0) {
+            opts.threshold = parseNumber(argv[0], flag, arg);
+        } else if (strcmp(flag, "--write") == 0 && arg != nullptr) {
+            opts.write_path = arg;
+        } else if (strcmp(flag, "--compare") == 0 && arg != nullptr) {
+            opts.compare_path = arg;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", flag);
+            usage(argv[0]);
+            EXIT(1);
+        }
+        ++i;
+    }
+
+    Dims dims = opts.config.dims;
+    opts.config.start_loc = Location{dims.height / 2, dims.width / 2};
+
+    if (dims.area() == 0 || opts.boards == 0 || opts.reps == 0 ||
+        opts.config.mine_count >=
+            dims.area() - neighborCount(opts.config.start_loc, dims)) {
+        fprintf(stderr, "Invalid corpus: %zux%zu, %zu mines, %zu boards\n",
+                dims.width, dims.height, opts.config.mine_count, opts.boards);
+        EXIT(1);
+    }
+
+    return opts;
+}
+
+int main(int argc, char **argv) {
+    MicroOptions opts = parseOptions(argc, argv);
+    Slice<RulePlugin *> plugins = loadRulePlugins();
+
+    Dims dims = opts.config.dims;
+    size_t board_size = dims.area() * sizeof(Cell) + sizeof(Grid) + 64;
+    Arena corpus_arena =
+        makeArena(2 * opts.boards * board_size + 2 * gridArenaSize(dims));
+    Arena gen_arena = makeArena(gridArenaSize(dims));
+    Arena rule_arena = makeArena(64 * 1024);
+    Arena plane_arena = makeArena(dims.area() * (4 + sizeof(Cell)) + 64);
+    Arena bit_arena = makeArena(dims.area() + 3 * Bitboard::planeSize(dims) +
+                                Bitboard::arenaSize(dims));
+
+    GridSolver solver{};
+    initSolver(&solver, grid_api, SolveMode::sm_worklist);
+    registerRules(&rule_arena, &solver, plugins);
+
+    Corpus corpus = makeCorpus(&corpus_arena, &opts, &solver);
+
+    size_t count = 9 + solver.rules.len;
+    Slice<Measurement> measurements{new Measurement[count](), 0};
+
+    measurements.ptr[measurements.len++] = benchGenerate(&gen_arena, &opts);
+    measurements.ptr[measurements.len++] = benchUncover(&corpus, &opts);
+    measurements.ptr[measurements.len++] = benchRollback(&corpus, &opts);
+    measurements.ptr[measurements.len++] =
+        benchSplitJoin(&corpus, &opts, &plane_arena);
+    measurements.ptr[measurements.len++] =
+        benchScanHidden(&corpus, &opts, &plane_arena, false);
+    measurements.ptr[measurements.len++] =
+        benchScanHidden(&corpus, &opts, &plane_arena, true);
+    measurements.ptr[measurements.len++] =
+        benchBitboard(&corpus, &opts, &bit_arena);
+    measurements.ptr[measurements.len++] =
+        benchCountMines(&corpus, &opts, &bit_arena, true);
+    measurements.ptr[measurements.len++] =
+        benchCountMines(&corpus, &opts, &bit_arena, false);
+    for (GridSolver::Rule &rule : solver.rules) {
+        measurements.ptr[measurements.len++] =
+            benchRule(&corpus, &opts, &rule);
+    }
+
+    printf("%zux%zu, %zu mines, seed %llu, %zu boards, best of %zu\n",
+           dims.width, dims.height, opts.config.mine_count,
+           (unsigned long long)opts.config.seed, opts.boards, opts.reps);
+    printMeasurements(measurements);
+
+    if (opts.write_path != nullptr) {
+        writeBaseline(opts.write_path, measurements);
+    }
+
+    size_t regressions = 0;
+    if (opts.compare_path != nullptr) {
+        printf("\n");
+        regressions =
+            compareBaseline(opts.compare_path, measurements, opts.threshold);
+    }
+
+    delete[] measurements.ptr;
+    deregisterRules(&solver, plugins);
+    deinitSolver(&solver);
+    freeArena(&bit_arena);
+    freeArena(&plane_arena);
+    freeArena(&rule_arena);
+    freeArena(&gen_arena);
+    freeArena(&corpus_arena);
+    unloadRulePlugins();
+
+    return regressions > 0 ? 1 : 0;
+}
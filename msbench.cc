@@ -0,0 +1,379 @@
+#include "grid.h"
+#include "solver.h"
+
+#include "arena.cc"
+#include "dirutils.cc"
+#include "grid.cc"
+#include "parallel.cc"
+#include "rules.cc"
+#include "slice.cc"
+#include "solver.cc"
+#include "utils.cc"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Solves a range of generated boards without a window and reports how fast
+// and how often that went, as one line of JSON (or CSV).
+
+struct BenchOptions {
+    BoardConfig config;
+    uint64_t first;
+    size_t boards;
+    size_t threads;
+    size_t parallel; // threads per board, 0 to solve each on one
+    SolveMode mode;
+    RulePolicy policy;
+    bool csv;
+};
+
+// each worker takes its own contiguous range of board indices, so a run is
+// the same boards whatever the thread count
+struct BenchWorker {
+    BenchOptions const *opts;
+    Slice<RulePlugin *> plugins;
+    pthread_t thread;
+
+    uint64_t begin;
+    uint64_t end;
+    Slice<uint64_t> solve_ns; // one per board of the range
+
+    Arena rule_arena;
+    Arena grid_arena;
+    GridSolver solver;
+    ParallelSolver par;
+
+    size_t solvable;
+    size_t applied;
+    size_t worked;
+
+    static auto run(void *data) -> void * {
+        auto worker = static_cast<BenchWorker *>(data);
+        worker->work();
+        return nullptr;
+    }
+
+    auto work() -> void {
+        for (uint64_t index = this->begin; index < this->end; ++index) {
+            this->grid_arena.reset(0);
+            Grid grid =
+                generateBoard(&this->grid_arena, this->opts->config, index);
+
+            if (this->opts->parallel > 0) {
+                uint64_t start_ns = nanoTime();
+                bool solvable = solveParallel(&this->par, &grid, grid_api);
+                this->solve_ns[index - this->begin] = nanoTime() - start_ns;
+
+                this->solvable += solvable;
+                this->applied += this->par.calls;
+                this->worked += this->par.worked;
+                continue;
+            }
+
+            uint64_t start_ns = nanoTime();
+            bool solvable = this->solver.solvable(&grid);
+            this->solve_ns[index - this->begin] = nanoTime() - start_ns;
+
+            this->solvable += solvable;
+            this->applied += this->solver.state.applied;
+            this->worked += this->solver.state.worked;
+        }
+    }
+};
+
+static auto usage(char const *prog) -> void {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --width N     grid width (30)\n"
+            "  --height N    grid height (16)\n"
+            "  --mines N     mine count (99)\n"
+            "  --seed N      board config seed (0)\n"
+            "  --first N     first board index (0)\n"
+            "  --boards N    number of boards (1000)\n"
+            "  --threads N   worker threads (1)\n"
+            "  --parallel N  solve each board on N threads, by tiles of rows\n"
+            "  --sweep       solve in sweep mode instead of worklist\n"
+            "  --flat        run every rule every epoch instead of by tier\n"
+            "  --csv         print CSV instead of JSON\n",
+            prog);
+}
+
+static auto parseNumber(char const *prog, char const *flag, char const *arg)
+    -> uint64_t {
+    if (arg == nullptr) {
+        fprintf(stderr, "Missing value for %s\n", flag);
+        usage(prog);
+        EXIT(1);
+    }
+
+    uint64_t value;
+    if (!parseU64(arg, &value)) {
+        fprintf(stderr, "Invalid value for %s: %s\n", flag, arg);
+        usage(prog);
+        EXIT(1);
+    }
+    return value;
+}
+
+static auto parseOptions(int argc, char **argv) -> BenchOptions {
+    BenchOptions opts{};
+    opts.config.dims = Dims{30, 16};
+    opts.config.mine_count = 99;
+    opts.boards = 1000;
+    opts.threads = 1;
+    opts.mode = SolveMode::sm_worklist;
+    opts.policy = RulePolicy::rp_tiered;
+
+    for (int i = 1; i < argc; ++i) {
+        char const *flag = argv[i];
+        char const *arg = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (strcmp(flag, "--width") == 0) {
+            opts.config.dims.width = parseNumber(argv[0], flag, arg);
+            ++i;
+        } else if (strcmp(flag, "--height") == 0) {
+            opts.config.dims.height = parseNumber(argv[0], flag, arg);
+            ++i;
+        } else if (strcmp(flag, "--mines") == 0) {
+            opts.config.mine_count = parseNumber(argv[0], flag, arg);
+            ++i;
+        } else if (strcmp(flag, "--seed") == 0) {
+            opts.config.seed = parseNumber(argv[0], flag, arg);
+            ++i;
+        } else if (strcmp(flag, "--first") == 0) {
+            opts.first = parseNumber(argv[0], flag, arg);
+            ++i;
+        } else if (strcmp(flag, "--boards") == 0) {
+            opts.boards = parseNumber(argv[0], flag, arg);
+            ++i;
+        } else if (strcmp(flag, "--threads") == 0) {
+            opts.threads = parseNumber(argv[0], flag, arg);
+            ++i;
+        } else if (strcmp(flag, "--parallel") == 0) {
+            opts.parallel = parseNumber(argv[0], flag, arg);
+            ++i;
+        } else if (strcmp(flag, "--sweep") == 0) {
+            opts.mode = SolveMode::sm_sweep;
+        } else if (strcmp(flag, "--flat") == 0) {
+            opts.policy = RulePolicy::rp_flat;
+        } else if (strcmp(flag, "--csv") == 0) {
+            opts.csv = true;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", flag);
+            usage(argv[0]);
+            EXIT(1);
+        }
+    }
+
+    Dims dims = opts.config.dims;
+    if (dims.width == 0 || dims.height == 0) {
+        fprintf(stderr, "Invalid dimensions %zux%zu\n", dims.width,
+                dims.height);
+        EXIT(1);
+    }
+
+    // the first click is in the middle, like the generator's preview
+    opts.config.start_loc = Location{dims.height / 2, dims.width / 2};
+
+    size_t free_cells =
+        dims.area() - neighborCount(opts.config.start_loc, dims);
+    if (opts.config.mine_count >= free_cells) {
+        fprintf(stderr, "Too many mines for %zux%zu (at most %zu)\n",
+                dims.width, dims.height, free_cells - 1);
+        EXIT(1);
+    }
+
+    if (opts.boards == 0 || opts.threads == 0) {
+        fprintf(stderr, "Need at least one board and one thread\n");
+        EXIT(1);
+    }
+    if (opts.threads > opts.boards) {
+        opts.threads = opts.boards;
+    }
+
+    return opts;
+}
+
+static auto compareNs(void const *a, void const *b) -> int {
+    uint64_t lhs = *(uint64_t const *)a;
+    uint64_t rhs = *(uint64_t const *)b;
+    return lhs < rhs ? -1 : lhs > rhs;
+}
+
+// nearest rank, times must be sorted
+static auto percentileUs(Slice<uint64_t> times, double p) -> double {
+    size_t rank = (size_t)(p * times.len + 0.999999);
+    size_t idx = rank > 0 ? rank - 1 : 0;
+    return times[idx] / 1e3;
+}
+
+// summed over the workers, which all registered the same rules; nothing is
+// printed unless the solver was built with SOLVER_PROFILE
+static auto addRuleStats(RuleStats *total, GridSolver &solver, size_t idx)
+    -> void {
+    RuleStats stats = solver.ruleStats(idx).get();
+    total->calls += stats.calls;
+    total->worked += stats.worked;
+    total->cells_changed += stats.cells_changed;
+    total->ns += stats.ns;
+}
+
+static auto printRuleStats(Slice<BenchWorker> workers, bool csv) -> void {
+    GridSolver &first = workers[0].solver;
+    if (first.rules.len == 0 || !first.ruleStats(0).valid) {
+        return;
+    }
+
+    if (csv) {
+        printf("\nrule,calls,worked,cells_changed,ns\n");
+    } else {
+        printf(", \"rules\": [");
+    }
+
+    for (size_t idx = 0; idx < first.rules.len; ++idx) {
+        RuleStats total{};
+        for (BenchWorker &worker : workers) {
+            // with --parallel the boards are solved by the parallel solver's
+            // workers and worker.solver never runs
+            if (worker.opts->parallel > 0) {
+                for (ParallelSolver::Worker &par_worker : worker.par.workers) {
+                    addRuleStats(&total, par_worker.solver, idx);
+                }
+            } else {
+                addRuleStats(&total, worker.solver, idx);
+            }
+        }
+
+        StrSlice name = first.ruleAt(idx).name;
+        if (csv) {
+            printf("%.*s,%zu,%zu,%zu,%llu\n", STR_ARGS(name), total.calls,
+                   total.worked, total.cells_changed,
+                   (unsigned long long)total.ns);
+        } else {
+            printf("%s{\"name\": \"%.*s\", \"calls\": %zu, \"worked\": %zu, "
+                   "\"cells_changed\": %zu, \"ns\": %llu}",
+                   idx > 0 ? ", " : "", STR_ARGS(name), total.calls,
+                   total.worked, total.cells_changed,
+                   (unsigned long long)total.ns);
+        }
+    }
+
+    if (!csv) {
+        printf("]");
+    }
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts = parseOptions(argc, argv);
+    Slice<RulePlugin *> plugins = loadRulePlugins();
+
+    Slice<uint64_t> solve_ns{new uint64_t[opts.boards](), opts.boards};
+    Slice<BenchWorker> workers{new BenchWorker[opts.threads](), opts.threads};
+
+    size_t per_worker = opts.boards / opts.threads;
+    size_t extra = opts.boards % opts.threads;
+    uint64_t next = opts.first;
+
+    for (size_t i = 0; i < workers.len; ++i) {
+        BenchWorker &worker = workers[i];
+        size_t count = per_worker + (i < extra ? 1 : 0);
+
+        worker.opts = &opts;
+        worker.plugins = plugins;
+        worker.begin = next;
+        worker.end = next + count;
+        worker.solve_ns = solve_ns.slice(next - opts.first,
+                                         next - opts.first + count);
+        next += count;
+
+        worker.rule_arena = makeArena(64 * 1024);
+        worker.grid_arena = makeArena(gridArenaSize(opts.config.dims));
+        initSolver(&worker.solver, grid_api, opts.mode);
+        worker.solver.setPolicy(opts.policy);
+        setupGeneratorSolver(&worker.rule_arena, &worker.solver,
+                             &worker.plugins);
+
+        if (opts.parallel > 0) {
+            initParallelSolver(&worker.par, opts.parallel, 4, 64 * 1024,
+                               &setupGeneratorSolver, &teardownGeneratorSolver,
+                               &worker.plugins);
+            setParallelPolicy(&worker.par, opts.policy);
+        }
+    }
+
+    uint64_t start_ns = nanoTime();
+    for (BenchWorker &worker : workers) {
+        int err = pthread_create(&worker.thread, nullptr, &BenchWorker::run,
+                                 &worker);
+        if (err != 0) {
+            fprintf(stderr, "Failed to start bench thread (%d)\n", err);
+            EXIT(1);
+        }
+    }
+
+    size_t solvable = 0;
+    size_t applied = 0;
+    size_t worked = 0;
+    for (BenchWorker &worker : workers) {
+        pthread_join(worker.thread, nullptr);
+        solvable += worker.solvable;
+        applied += worker.applied;
+        worked += worker.worked;
+    }
+    double elapsed_s = (nanoTime() - start_ns) / 1e9;
+
+    qsort(solve_ns.ptr, solve_ns.len, sizeof(uint64_t), &compareNs);
+
+    BoardConfig config = opts.config;
+    double boards_per_s = opts.boards / elapsed_s;
+    double solvable_rate = (double)solvable / opts.boards;
+    double p50_us = percentileUs(solve_ns, 0.50);
+    double p99_us = percentileUs(solve_ns, 0.99);
+
+    if (opts.csv) {
+        printf("width,height,mines,seed,first,boards,threads,elapsed_s,"
+               "boards_per_s,solvable,solvable_rate,p50_solve_us,"
+               "p99_solve_us,rule_calls,rule_work\n");
+        printf("%zu,%zu,%zu,%llu,%llu,%zu,%zu,%.3f,%.1f,%zu,%.4f,%.1f,%.1f,"
+               "%zu,%zu\n",
+               config.dims.width, config.dims.height, config.mine_count,
+               (unsigned long long)config.seed,
+               (unsigned long long)opts.first, opts.boards, opts.threads,
+               elapsed_s, boards_per_s, solvable, solvable_rate, p50_us,
+               p99_us, applied, worked);
+        printRuleStats(workers, true);
+    } else {
+        printf("{\"width\": %zu, \"height\": %zu, \"mines\": %zu, "
+               "\"seed\": %llu, \"first\": %llu, \"boards\": %zu, "
+               "\"threads\": %zu, \"elapsed_s\": %.3f, "
+               "\"boards_per_s\": %.1f, \"solvable\": %zu, "
+               "\"solvable_rate\": %.4f, \"p50_solve_us\": %.1f, "
+               "\"p99_solve_us\": %.1f, \"rule_calls\": %zu, "
+               "\"rule_work\": %zu",
+               config.dims.width, config.dims.height, config.mine_count,
+               (unsigned long long)config.seed,
+               (unsigned long long)opts.first, opts.boards, opts.threads,
+               elapsed_s, boards_per_s, solvable, solvable_rate, p50_us,
+               p99_us, applied, worked);
+        printRuleStats(workers, false);
+        printf("}\n");
+    }
+
+    for (BenchWorker &worker : workers) {
+        if (opts.parallel > 0) {
+            deinitParallelSolver(&worker.par);
+        }
+        teardownGeneratorSolver(&worker.solver, &worker.plugins);
+        deinitSolver(&worker.solver);
+        freeArena(&worker.grid_arena);
+        freeArena(&worker.rule_arena);
+    }
+    delete[] workers.ptr;
+    delete[] solve_ns.ptr;
+
+    unloadRulePlugins();
+    return 0;
+}
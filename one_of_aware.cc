@@ -6,6 +6,7 @@
 #include "linkedlist.cc"
 #include "slice.cc"
 
+#include <assert.h>
 #include <sys/types.h>
 
 struct CellOptions {
@@ -51,6 +52,10 @@ struct OneOfAwareRule {
         return rule->apply(grid, api, row, col);
     }
 
+    // selected options are disjoint and all next to the cell, so there are
+    // never more of them than it has neighbors
+    static constexpr size_t max_applied_ops = 8;
+
     Arena arena;
     OptionsKeeper keeper;
 
@@ -58,36 +63,26 @@ struct OneOfAwareRule {
         LinkedList<CellOptions>::initSentinel(&this->keeper.options_sentinel);
 
         for (Cell &cell : grid->cells) {
+            // only what the player can see may be used as an option
+            if (cell.display_type != CellDisplayType::cdt_value ||
+                cell.type != CellType::ct_number) {
+                continue;
+            }
+
             if (cell.eff_number != 1) {
                 continue;
             }
 
+            Location *loc_ptr = this->arena.pushTN<Location>(cell.hidden_count);
             size_t loc_count = 0;
 
-            { // new scope so I can reuse the iterator names
-                auto neighbor_op = Op<Grid::Neighbor>::empty();
-                auto neighbor_it = grid->neighborIterator(&cell);
-                while ((neighbor_op = neighbor_it.next()).valid) {
-                    Grid::Neighbor neighbor = neighbor_op.get();
-                    if ((*neighbor.cell).display_type ==
-                        CellDisplayType::cdt_hidden) {
-                        ++loc_count;
-                    }
-                }
-            }
-
-            Location *loc_ptr = this->arena.pushTN<Location>(loc_count);
-            loc_count = 0;
-
-            { // new scope so I can reuse the iterator names
-                auto neighbor_op = Op<Grid::Neighbor>::empty();
-                auto neighbor_it = grid->neighborIterator(&cell);
-                while ((neighbor_op = neighbor_it.next()).valid) {
-                    Grid::Neighbor neighbor = neighbor_op.get();
-                    if ((*neighbor.cell).display_type ==
-                        CellDisplayType::cdt_hidden) {
-                        loc_ptr[loc_count++] = neighbor.loc;
-                    }
+            auto neighbor_op = Op<Grid::Neighbor>::empty();
+            auto neighbor_it = grid->neighborIterator(&cell);
+            while ((neighbor_op = neighbor_it.next()).valid) {
+                Grid::Neighbor neighbor = neighbor_op.get();
+                if ((*neighbor.cell).display_type ==
+                    CellDisplayType::cdt_hidden) {
+                    loc_ptr[loc_count++] = neighbor.loc;
                 }
             }
 
@@ -107,46 +102,49 @@ struct OneOfAwareRule {
             return false;
         }
 
+        // the selection lives on the stack, not the arena, so applying
+        // only reads what onStart left and can run on several threads
+        CellOptions applied[max_applied_ops];
         return this->applyInner(grid, api, cur_loc,
                                 this->keeper.options_sentinel.next,
-                                Slice<CellOptions>{});
+                                Slice<CellOptions>{applied, 0});
     }
 
     auto applyInner(Grid *grid, GridApi api, Location cur_loc,
                     LinkedList<CellOptions> *remaining_ops,
                     Slice<CellOptions> applied_ops) -> bool {
-        size_t mark = this->arena.len;
-        if (remaining_ops == &this->keeper.options_sentinel) {
+        bool did_work = false;
+
+        // every selection of options is worth checking, not only the ones
+        // that happen to end with the last option in the list
+        if (applied_ops.len > 0) {
             Cell &cell = (*grid)[cur_loc];
 
             bool flag_work = flagPossibleCells(grid, api, &cell, applied_ops);
             bool reveal_work =
                 revealPossibleCells(grid, api, &cell, applied_ops);
 
-            return flag_work || reveal_work;
+            did_work = flag_work || reveal_work;
         }
 
-        bool did_work = false;
-
         // prev, since I am about to get the next on the first iteration
         LinkedList<CellOptions> *rem = remaining_ops->prev;
         while ((rem = rem->next) != &this->keeper.options_sentinel) {
             CellOptions next_op = rem->val;
 
-            if (!isValidOp(next_op, cur_loc, applied_ops, grid->dims)) {
+            if (!isValidOp(grid, next_op, cur_loc, applied_ops)) {
                 continue;
             }
 
-            CellOptions *pushed = this->arena.pushT<CellOptions>(next_op);
-            Slice<CellOptions> inner_slice{pushed - applied_ops.len,
+            assert(applied_ops.len < max_applied_ops && "Too many options");
+            applied_ops.ptr[applied_ops.len] = next_op;
+            Slice<CellOptions> inner_slice{applied_ops.ptr,
                                            applied_ops.len + 1};
 
             bool inner_work =
                 this->applyInner(grid, api, cur_loc, rem->next, inner_slice);
 
             did_work = inner_work || did_work;
-
-            this->arena.reset(mark);
         }
 
         return did_work;
@@ -158,21 +156,17 @@ struct OneOfAwareRule {
             return false;
         }
 
-        size_t hidden_count = 0;
-
-        auto neighbor_op = Op<Grid::Neighbor>::empty();
-        auto neighbor_it = grid->neighborIterator(cell);
-        while ((neighbor_op = neighbor_it.next()).valid) {
-            Grid::Neighbor neighbor = neighbor_op.get();
-            if ((*neighbor.cell).display_type != CellDisplayType::cdt_hidden) {
-                continue;
-            }
-
-            if (isSelectedOp(neighbor.loc, applied_ops)) {
-                continue;
+        // the selected options are disjoint and all next to the cell, so
+        // taking out the ones still hidden leaves the rest of its hidden
+        // neighbors
+        size_t hidden_count = cell->hidden_count;
+        for (auto &applied_op : applied_ops) {
+            for (auto &mine_op : applied_op.mine_options) {
+                if ((*grid)[mine_op].display_type ==
+                    CellDisplayType::cdt_hidden) {
+                    --hidden_count;
+                }
             }
-
-            ++hidden_count;
         }
 
         if (cell->eff_number - applied_ops.len == hidden_count) {
@@ -237,13 +231,22 @@ struct OneOfAwareRule {
         return false;
     }
 
-    auto isValidOp(CellOptions next_op, Location cur_loc,
-                   Slice<CellOptions> applied_ops, Dims grid_dims) -> bool {
+    auto isValidOp(Grid *grid, CellOptions next_op, Location cur_loc,
+                   Slice<CellOptions> applied_ops) -> bool {
         // early exit if the cell is too far away from the current location
         if (!rootCellReachesCurrent(next_op.root, cur_loc)) {
             return false;
         }
 
+        // options are collected at the start of the epoch, so skip any that
+        // were partially resolved since then; a flagged option would
+        // otherwise be counted against the effective number twice
+        for (auto &mine_loc : next_op.mine_options) {
+            if ((*grid)[mine_loc].display_type != CellDisplayType::cdt_hidden) {
+                return false;
+            }
+        }
+
         // if there is any overlap, skip this since there could be only one mine
         // in the overlapping areas
         for (auto &applied_op : applied_ops) {
@@ -257,7 +260,7 @@ struct OneOfAwareRule {
             bool found = false;
 
             auto neighbor_op = Op<Location>::empty();
-            auto neighbor_it = NeighborIterator{cur_loc, grid_dims};
+            auto neighbor_it = NeighborIterator{cur_loc, grid->dims};
             while ((neighbor_op = neighbor_it.next()).valid) {
                 if (neighbor_op.get().eql(mine_loc)) {
                     found = true;
@@ -308,21 +311,29 @@ auto registerRule(Arena *arena, GridSolver *solver, OneOfAwareRule *oneOfAware)
     GridSolver::Rule rule = GridSolver::Rule::from(
         OneOfAwareRule::applyRule, OneOfAwareRule::onEpochStart,
         OneOfAwareRule::onEpochFinish, oneOfAware, rule_name);
+    rule.tier = RuleTier::rt_region;
 
     solver->registerRule(arena, rule);
 }
 
-REGISTERER(regRule, arena, solver) {
+STATE_MAKER(makeState) {
     OneOfAwareRule *internal = new OneOfAwareRule();
     *internal = makeOneOfAware(MEGABYTES(4));
-    registerRule(arena, solver, internal);
+    return internal;
 }
 
-DEREGISTERER(deregRule, solver) {
-    GridSolver::Rule rule = solver->deregisterRule(rule_name);
-    OneOfAwareRule *internal = (OneOfAwareRule *)rule.data;
+STATE_FREER(freeState, state) {
+    OneOfAwareRule *internal = (OneOfAwareRule *)state;
     deleteOneOfAware(internal);
     delete internal;
 }
 
-RulePlugin plugin{regRule, deregRule};
+REGISTERER(regRule, arena, solver, state) {
+    registerRule(arena, solver, (OneOfAwareRule *)state);
+}
+
+DEREGISTERER(deregRule, solver) {
+    return solver->deregisterRule(rule_name).data;
+}
+
+RulePlugin plugin{regRule, deregRule, makeState, freeState};
@@ -0,0 +1,485 @@
+#pragma once
+
+#include "grid.h"
+#include "solver.h"
+
+#include "arena.cc"
+#include "dirutils.cc"
+#include "grid.cc"
+#include "gridgen.cc"
+#include "slice.cc"
+#include "solver.cc"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Solves one grid with every worker thread taking part in each epoch. The
+// grid is split into bands of rows (tiles) and the workers run the rules over
+// their tiles against the grid as it was at the start of the epoch, which
+// nobody changes until they are done. Rules get an api that only records what
+// they would have done, so every action follows from that snapshot. The
+// recorded actions are then applied tile by tile, in tile order, skipping
+// any that an earlier one already took care of; the result does not depend on
+// the number of workers or how the tiles were scheduled.
+//
+// Each worker has its own solver with its own copy of the rules (set up the
+// same way as for SolvableGenerator), since rules keep state between calls.
+// Whole-grid rules, the ones with epoch callbacks, are the exception: only
+// the first worker's copy is used. Their callbacks run once per epoch on the
+// thread driving the solve, and every worker applies that same copy, so
+// applying one of them may only read what its onStart left behind.
+//
+// The worker threads live as long as the solver and wait between epochs.
+
+enum ActionKind : unsigned char {
+    ak_flag = 1 << 0,
+    ak_unflag = 1 << 1,
+    ak_uncover = 1 << 2,
+};
+
+struct Action {
+    size_t idx;
+    ActionKind kind;
+#ifdef SOLVER_PROFILE
+    size_t rule; // the one that recorded it, for its cells_changed
+#endif
+};
+
+// what a worker is recording into, set for the duration of its tiles
+struct ActionRecorder {
+    Slice<Action> actions; // capacity, every kind at most once per cell
+    size_t len;
+    Slice<unsigned char> recorded; // kinds already recorded, per cell
+#ifdef SOLVER_PROFILE
+    size_t rule; // the one being applied
+#endif
+
+    auto record(size_t idx, ActionKind kind) -> void {
+        unsigned char &seen = this->recorded[idx];
+        if (seen & kind) {
+            return;
+        }
+        seen |= kind;
+
+        assert(this->len < this->actions.len && "Too many actions");
+        Action action{idx, kind};
+#ifdef SOLVER_PROFILE
+        action.rule = this->rule;
+#endif
+        this->actions[this->len++] = action;
+    }
+};
+
+static thread_local ActionRecorder *recorder = nullptr;
+
+static auto locIndex(Grid *grid, Location loc) -> size_t {
+    return loc.row * grid->dims.width + loc.col;
+}
+
+FlagCellLocType(recordFlagLoc, grid, loc) {
+    recorder->record(locIndex(grid, loc), ActionKind::ak_flag);
+}
+
+FlagCellCellType(recordFlagCell, grid, cell) {
+    recorder->record(grid->cells.indexOf(cell), ActionKind::ak_flag);
+}
+
+UnflagCellLocType(recordUnflagLoc, grid, loc) {
+    recorder->record(locIndex(grid, loc), ActionKind::ak_unflag);
+}
+
+UnflagCellCellType(recordUnflagCell, grid, cell) {
+    recorder->record(grid->cells.indexOf(cell), ActionKind::ak_unflag);
+}
+
+UncoverSelfAndNeighborsLocType(recordUncoverLoc, grid, loc) {
+    recorder->record(locIndex(grid, loc), ActionKind::ak_uncover);
+}
+
+UncoverSelfAndNeighborsCellType(recordUncoverCell, grid, cell) {
+    recorder->record(grid->cells.indexOf(cell), ActionKind::ak_uncover);
+}
+
+// no listener, so nothing reaches uncoverRegion and the grid is left alone
+static GridApi recording_api{
+    &recordFlagLoc,     &recordFlagCell,    &recordUnflagLoc,
+    &recordUnflagCell,  &recordUncoverLoc,  &recordUncoverCell,
+    &uncoverRegion,     nullptr,            nullptr,
+};
+
+struct ParallelSolver {
+    struct Tile {
+        size_t row_start;
+        size_t row_end;
+        Slice<Action> actions; // in the recording worker's buffer
+    };
+
+    struct Worker {
+        ParallelSolver *par;
+        pthread_t thread;
+        size_t index;
+        Arena rule_arena;
+        Arena action_arena;
+        GridSolver solver;
+        ActionRecorder recorder;
+
+        size_t calls;
+        size_t worked;
+    };
+
+    SolverSetup *setup;
+    SolverTeardown *teardown;
+    void *data;
+    Slice<Worker> workers;
+    size_t tile_rows;
+
+    // hands epochs to the workers: each one runs an epoch when it sees a new
+    // number, and the last to finish wakes the thread waiting on them
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    size_t epoch;
+    size_t busy;
+    bool quit;
+
+    // the epoch being run, read only for the workers
+    Arena tile_arena;
+    Slice<Tile> tiles;
+    Grid *grid;
+    unsigned char first_tier;
+    unsigned char tier;
+
+    // rule applications over the last solve, summed over the workers
+    size_t calls;
+    size_t worked;
+
+    static auto run(void *data) -> void * {
+        auto worker = static_cast<Worker *>(data);
+        ParallelSolver *par = worker->par;
+        size_t seen = 0;
+
+        pthread_mutex_lock(&par->lock);
+        while (true) {
+            while (par->epoch == seen && !par->quit) {
+                pthread_cond_wait(&par->wake, &par->lock);
+            }
+            if (par->quit) {
+                break;
+            }
+            seen = par->epoch;
+            pthread_mutex_unlock(&par->lock);
+
+            par->work(worker);
+
+            pthread_mutex_lock(&par->lock);
+            if (--par->busy == 0) {
+                pthread_cond_signal(&par->idle);
+            }
+        }
+        pthread_mutex_unlock(&par->lock);
+
+        return nullptr;
+    }
+
+    static auto wholeGrid(GridSolver::Rule &rule) -> bool {
+        return rule.onStart != nullptr || rule.onFinish != nullptr;
+    }
+
+    // tiles are dealt out round robin, which keeps the split fixed for a
+    // given worker count; it only affects who records what, not the order
+    // anything is applied in
+    auto work(Worker *worker) -> void {
+        GridSolver &solver = worker->solver;
+        GridSolver &shared = this->workers[0].solver;
+        Grid *grid = this->grid;
+
+        ActionRecorder &rec = worker->recorder;
+        rec.len = 0;
+        for (unsigned char &seen : rec.recorded) {
+            seen = 0;
+        }
+        recorder = &rec;
+
+        for (size_t t = worker->index; t < this->tiles.len;
+             t += this->workers.len) {
+            Tile &tile = this->tiles[t];
+            size_t begin = rec.len;
+
+            for (size_t row = tile.row_start; row < tile.row_end; ++row) {
+                for (size_t col = 0; col < grid->dims.width; ++col) {
+                    for (size_t i = solver.state.first_rule;
+                         i < solver.state.active_rules; ++i) {
+                        size_t idx = solver.order[i];
+                        GridSolver::Rule *rule = &solver.rules[idx];
+                        if (wholeGrid(*rule)) {
+                            rule = &shared.rules[idx];
+                        }
+
+#ifdef SOLVER_PROFILE
+                        rec.rule = idx;
+                        uint64_t start_ns = nanoTime();
+#endif
+                        bool did_work =
+                            rule->applyRule(grid, recording_api, row, col);
+#ifdef SOLVER_PROFILE
+                        RuleStats &stats = solver.stats[idx];
+                        ++stats.calls;
+                        stats.worked += did_work;
+                        stats.ns += nanoTime() - start_ns;
+#endif
+                        worker->worked += did_work;
+                        ++worker->calls;
+                    }
+                }
+            }
+
+            tile.actions = rec.actions.slice(begin, rec.len);
+        }
+
+        recorder = nullptr;
+    }
+
+    // applies one recorded action unless an earlier one got there first,
+    // returns the number of cells it changed
+    static auto apply(Grid *grid, GridApi api, Action action) -> size_t {
+        Cell *cell = &grid->cells[action.idx];
+        CellDisplayType before = cell->display_type;
+
+        switch (action.kind) {
+        case ak_flag: {
+            // the snapshot had it hidden, so it was uncovered since
+            if (before == CellDisplayType::cdt_value) {
+                return 0;
+            }
+            api.flagCell(grid, cell);
+        } break;
+        case ak_unflag: {
+            api.unflagCell(grid, cell);
+        } break;
+        case ak_uncover: {
+            // a zero reveals a whole region
+            size_t revealed = grid->safe_revealed + grid->mines_revealed;
+            api.uncoverSelfAndNeighbors(grid, cell);
+            return grid->safe_revealed + grid->mines_revealed - revealed;
+        } break;
+        }
+
+        return cell->display_type != before;
+    }
+
+    // the whole-grid callbacks of the active tiers, run once on behalf of
+    // every worker on the first worker's copy of the rules, which is also
+    // where their time is counted
+    auto runCallbacks(Grid *grid, GridApi api, bool start) -> void {
+        GridSolver &shared = this->workers[0].solver;
+        Slice<size_t> rules = start ? shared.start_rules : shared.finish_rules;
+
+        for (size_t idx : rules) {
+            GridSolver::Rule &rule = shared.rules[idx];
+            if (!shared.tierActive(rule)) {
+                continue;
+            }
+#ifdef SOLVER_PROFILE
+            uint64_t start_ns = nanoTime();
+#endif
+            if (start) {
+                rule.onStart(grid, api, rule.data);
+            } else {
+                rule.onFinish(grid, api, rule.data);
+            }
+#ifdef SOLVER_PROFILE
+            shared.stats[idx].ns += nanoTime() - start_ns;
+#endif
+        }
+    }
+
+    // one epoch over every tile, returns the number of cells it changed
+    auto runEpoch(Grid *grid, GridApi api) -> size_t {
+        this->grid = grid;
+        for (Worker &worker : this->workers) {
+            worker.solver.setTiers(this->first_tier, this->tier);
+        }
+
+        this->runCallbacks(grid, api, true);
+
+        pthread_mutex_lock(&this->lock);
+        this->busy = this->workers.len;
+        ++this->epoch;
+        pthread_cond_broadcast(&this->wake);
+        while (this->busy > 0) {
+            pthread_cond_wait(&this->idle, &this->lock);
+        }
+        pthread_mutex_unlock(&this->lock);
+
+        size_t changed = 0;
+        for (Tile &tile : this->tiles) {
+            for (Action action : tile.actions) {
+                size_t cells = apply(grid, api, action);
+                changed += cells;
+#ifdef SOLVER_PROFILE
+                this->workers[0].solver.stats[action.rule].cells_changed +=
+                    cells;
+#endif
+            }
+        }
+
+        this->runCallbacks(grid, api, false);
+
+        return changed;
+    }
+
+    auto reserve(Dims dims) -> void {
+        size_t tile_count = (dims.height + this->tile_rows - 1) /
+                            this->tile_rows;
+        SolvableGenerator::reserve(&this->tile_arena,
+                                   tile_count * sizeof(Tile));
+        this->tiles =
+            Slice<Tile>{this->tile_arena.pushTN<Tile>(tile_count), tile_count};
+
+        for (size_t t = 0; t < tile_count; ++t) {
+            size_t row_end = (t + 1) * this->tile_rows;
+            this->tiles[t].row_start = t * this->tile_rows;
+            this->tiles[t].row_end =
+                row_end < dims.height ? row_end : dims.height;
+        }
+
+        size_t cell_count = dims.area();
+        for (Worker &worker : this->workers) {
+            SolvableGenerator::reserve(&worker.action_arena,
+                                       cell_count * (3 * sizeof(Action) + 1));
+
+            ActionRecorder &rec = worker.recorder;
+            rec.actions = Slice<Action>{
+                worker.action_arena.pushTN<Action>(3 * cell_count),
+                3 * cell_count};
+            rec.recorded = Slice<unsigned char>{
+                worker.action_arena.pushTN<unsigned char>(cell_count),
+                cell_count};
+            rec.len = 0;
+        }
+    }
+};
+
+auto initParallelSolver(ParallelSolver *par, size_t worker_count,
+                        size_t tile_rows, size_t rule_arena_size,
+                        SolverSetup *setup, SolverTeardown *teardown,
+                        void *data) -> void {
+    if (worker_count == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cores > 0 ? cores : 1;
+    }
+    assert(tile_rows > 0 && "Empty tiles");
+
+    par->setup = setup;
+    par->teardown = teardown;
+    par->data = data;
+    par->tile_rows = tile_rows;
+    par->workers = Slice<ParallelSolver::Worker>{
+        new ParallelSolver::Worker[worker_count](), worker_count};
+
+    for (size_t i = 0; i < par->workers.len; ++i) {
+        ParallelSolver::Worker &worker = par->workers[i];
+        worker.par = par;
+        worker.index = i;
+        worker.rule_arena = makeArena(rule_arena_size);
+        initSolver(&worker.solver, recording_api, SolveMode::sm_sweep);
+        setup(&worker.rule_arena, &worker.solver, data);
+
+        assert(worker.solver.rules.len == par->workers[0].solver.rules.len &&
+               "Workers set up different rules");
+    }
+
+    pthread_mutex_init(&par->lock, nullptr);
+    pthread_cond_init(&par->wake, nullptr);
+    pthread_cond_init(&par->idle, nullptr);
+    par->epoch = 0;
+    par->busy = 0;
+    par->quit = false;
+
+    for (ParallelSolver::Worker &worker : par->workers) {
+        int err = pthread_create(&worker.thread, nullptr,
+                                 &ParallelSolver::run, &worker);
+        if (err != 0) {
+            fprintf(stderr, "Failed to start solver thread (%d)\n", err);
+            EXIT(1);
+        }
+    }
+}
+
+auto setParallelPolicy(ParallelSolver *par, RulePolicy policy) -> void {
+    for (ParallelSolver::Worker &worker : par->workers) {
+        worker.solver.setPolicy(policy);
+    }
+}
+
+// Runs epochs until one at the top tier changes nothing, escalating through
+// the tiers the same way GridSolver does. Changes go through api, so a
+// listener sees every one of them.
+auto solveParallel(ParallelSolver *par, Grid *grid, GridApi api) -> bool {
+    par->reserve(grid->dims);
+
+    GridSolver &first = par->workers[0].solver;
+    unsigned char lowest = first.lowestTier();
+    par->first_tier = 0;
+    par->tier = lowest;
+    for (ParallelSolver::Worker &worker : par->workers) {
+        worker.calls = 0;
+        worker.worked = 0;
+    }
+
+    while (true) {
+        size_t changed = par->runEpoch(grid, api);
+
+        if (changed > 0) {
+            par->first_tier = 0;
+            par->tier = lowest;
+        } else if (par->tier < first.max_tier) {
+            // the tiers below just found nothing on this same grid
+            ++par->tier;
+            par->first_tier = par->tier;
+        } else {
+            break;
+        }
+    }
+
+    par->calls = 0;
+    par->worked = 0;
+    for (ParallelSolver::Worker &worker : par->workers) {
+        par->calls += worker.calls;
+        par->worked += worker.worked;
+    }
+
+    return gridSolved(*grid);
+}
+
+auto deinitParallelSolver(ParallelSolver *par) -> void {
+    pthread_mutex_lock(&par->lock);
+    par->quit = true;
+    pthread_cond_broadcast(&par->wake);
+    pthread_mutex_unlock(&par->lock);
+
+    for (ParallelSolver::Worker &worker : par->workers) {
+        pthread_join(worker.thread, nullptr);
+    }
+    pthread_cond_destroy(&par->idle);
+    pthread_cond_destroy(&par->wake);
+    pthread_mutex_destroy(&par->lock);
+
+    for (ParallelSolver::Worker &worker : par->workers) {
+        par->teardown(&worker.solver, par->data);
+        deinitSolver(&worker.solver);
+
+        if (worker.action_arena.ptr != nullptr) {
+            freeArena(&worker.action_arena);
+        }
+        freeArena(&worker.rule_arena);
+    }
+    delete[] par->workers.ptr;
+    par->workers = Slice<ParallelSolver::Worker>{nullptr, 0};
+
+    if (par->tile_arena.ptr != nullptr) {
+        freeArena(&par->tile_arena);
+    }
+}
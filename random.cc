@@ -0,0 +1,74 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+
+// xoshiro256**, the state is passed around explicitly so every generator (and
+// every thread) has its own and any sequence can be replayed from its seed.
+struct Rng {
+    uint64_t s[4];
+};
+
+static inline auto rotl(uint64_t x, int k) -> uint64_t {
+    return (x << k) | (x >> (64 - k));
+}
+
+// the splitmix64 finalizer, a bijection that scrambles every bit into every
+// other one
+static inline auto mix64(uint64_t z) -> uint64_t {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+auto splitMix64(uint64_t *state) -> uint64_t {
+    return mix64(*state += 0x9e3779b97f4a7c15);
+}
+
+// expands a seed into a full state, so nearby seeds give unrelated sequences
+auto seedRng(uint64_t seed) -> Rng {
+    Rng rng;
+    for (uint64_t &word : rng.s) {
+        word = splitMix64(&seed);
+    }
+    return rng;
+}
+
+// Counter based: the state for stream `counter` of `key` is hashed straight
+// from the two, so stream N can be made without running the N before it.
+// Different counters of one key never share a seed since mix64 is a bijection.
+auto keyedRng(uint64_t key, uint64_t counter) -> Rng {
+    return seedRng(mix64(mix64(key) ^ counter));
+}
+
+auto nextRandom(Rng *rng) -> uint64_t {
+    uint64_t *s = rng->s;
+    uint64_t res = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return res;
+}
+
+// uniform in [0, bound) without modulo bias (Lemire's multiply and reject)
+auto randomBelow(Rng *rng, uint64_t bound) -> uint64_t {
+    assert(bound > 0 && "Empty range");
+
+    __uint128_t m = (__uint128_t)nextRandom(rng) * bound;
+    uint64_t low = (uint64_t)m;
+    if (low < bound) {
+        uint64_t threshold = -bound % bound;
+        while (low < threshold) {
+            m = (__uint128_t)nextRandom(rng) * bound;
+            low = (uint64_t)m;
+        }
+    }
+    return (uint64_t)(m >> 64);
+}
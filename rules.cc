@@ -0,0 +1,198 @@
+#pragma once
+
+#include "grid.h"
+#include "solver.h"
+
+#include "arena.cc"
+#include "generated.cc"
+#include "grid.cc"
+#include "gridgen.cc"
+#include "op.cc"
+#include "slice.cc"
+#include "solver.cc"
+#include "strslice.cc"
+#include "utils.cc"
+
+#include <dlfcn.h>
+#include <stdio.h>
+
+// The rules every front end solves with: the local rules below, the pattern
+// plugins and the rule plugins listed here.
+
+static GridApi grid_api{
+    &flagCell,
+    &flagCell,
+    &unflagCell,
+    &unflagCell,
+    &uncoverSelfAndNeighbors,
+    &uncoverSelfAndNeighbors,
+    &uncoverRegion,
+};
+
+// local rules {{{1
+// flag_remaining_cells {{{2
+auto flag_remaining_cells(Grid *grid, GridApi api, size_t row, size_t col,
+                          void *) -> bool {
+    Cell cur = (*grid)[row][col];
+    if (cur.display_type != CellDisplayType::cdt_value ||
+        cur.type != CellType::ct_number) {
+        return false;
+    }
+
+    if (cur.eff_number == 0) {
+        return false;
+    }
+
+    if (cur.eff_number == cur.hidden_count) {
+        // flag all hidden cells
+        bool did_work = false;
+
+        auto neighbor_op = Op<Grid::Neighbor>::empty();
+        auto neighbor_it = grid->neighborIterator(row, col);
+        while ((neighbor_op = neighbor_it.next()).valid) {
+            Grid::Neighbor neighbor = neighbor_op.get();
+            Cell *cell = neighbor.cell;
+            if (cell->display_type == CellDisplayType::cdt_hidden) {
+                api.flagCell(grid, neighbor.loc);
+                did_work = true;
+            }
+        }
+        return did_work;
+    }
+
+    return false;
+};
+// }}}2
+
+// show_hidden_cells {{{2
+auto show_hidden_cells(Grid *grid, GridApi api, size_t row, size_t col, void *)
+    -> bool {
+    Cell cur = (*grid)[row][col];
+    if (cur.display_type != CellDisplayType::cdt_value ||
+        cur.type != CellType::ct_number) {
+        return false;
+    }
+
+    size_t mine_count = cur.number;
+    if (mine_count == 0) {
+        return false;
+    }
+
+    if (cur.hidden_count == 0) {
+        return false;
+    }
+
+    size_t eff_mine_count = cur.eff_number;
+    if (eff_mine_count == 0) {
+        // show all hidden cells
+        bool did_work = false;
+
+        auto neighbor_op = Op<Grid::Neighbor>::empty();
+        auto neighbor_it = grid->neighborIterator(row, col);
+        while ((neighbor_op = neighbor_it.next()).valid) {
+            Grid::Neighbor neighbor = neighbor_op.get();
+            Cell *cell = neighbor.cell;
+            if (cell->display_type == CellDisplayType::cdt_hidden) {
+                api.uncoverSelfAndNeighbors(grid, neighbor.loc);
+                did_work = true;
+            }
+        }
+        return did_work;
+    }
+
+    return false;
+}
+// }}}2
+
+// click remaining cells {{{2
+auto click_remaining_cells(Grid *grid, GridApi api, size_t row, size_t col,
+                           void *) -> bool {
+    long remainingFlags = gridRemainingFlags(*grid);
+    if (remainingFlags == 0) {
+        Cell &cell = (*grid)[row][col];
+        if (cell.display_type == CellDisplayType::cdt_hidden) {
+            api.uncoverSelfAndNeighbors(grid, &cell);
+            return true;
+        }
+    }
+    return false;
+}
+// }}}2
+// }}}1
+
+auto registerRules(Arena *arena, GridSolver *solver,
+                   Slice<RulePlugin *> plugins) -> void {
+    GridSolver::Rule flag_remaining_rule = GridSolver::Rule::from(
+        &flag_remaining_cells, STR_SLICE("flag_remaining_cells"));
+    GridSolver::Rule show_hidden_rule = GridSolver::Rule::from(
+        &show_hidden_cells, STR_SLICE("show_hidden_cells"));
+    GridSolver::Rule click_remaining_rule = GridSolver::Rule::from(
+        &click_remaining_cells, STR_SLICE("click_remaining_cells"));
+
+    solver->registerRule(arena, flag_remaining_rule);
+    solver->registerRule(arena, show_hidden_rule);
+    solver->registerRule(arena, click_remaining_rule);
+    registerPatterns(arena, solver);
+    for (auto plugin : plugins) {
+        plugin->registerWith(arena, solver);
+    }
+}
+
+auto deregisterRules(GridSolver *solver, Slice<RulePlugin *> plugins) -> void {
+    for (auto plugin : plugins) {
+        plugin->deregisterFrom(solver);
+    }
+    deregisterPatterns(solver);
+}
+
+SOLVER_SETUP(setupGeneratorSolver, arena, solver, data) {
+    auto plugins = static_cast<Slice<RulePlugin *> *>(data);
+    registerRules(arena, solver, *plugins);
+}
+
+SOLVER_TEARDOWN(teardownGeneratorSolver, solver, data) {
+    auto plugins = static_cast<Slice<RulePlugin *> *>(data);
+    deregisterRules(solver, *plugins);
+}
+
+static char const *rule_plugin_objs[] = {
+    SO("./one_of_aware"),
+    SO("./linear"),
+    SO("./frontier"),
+};
+
+static constexpr size_t rule_plugin_count = ARRAY_LEN(rule_plugin_objs);
+
+static void *rule_plugin_handles[rule_plugin_count];
+static RulePlugin *rule_plugins[rule_plugin_count];
+
+// loads the pattern plugins as well, everything registerRules needs
+auto loadRulePlugins() -> Slice<RulePlugin *> {
+    for (size_t i = 0; i < rule_plugin_count; ++i) {
+        void *handle = dlopen(rule_plugin_objs[i], RTLD_NOW);
+        if (handle == nullptr) {
+            fprintf(stderr, "Failed to open object: %s\n", dlerror());
+            EXIT(1);
+        }
+
+        RulePlugin *plugin = (RulePlugin *)dlsym(handle, "plugin");
+        if (plugin == nullptr) {
+            fprintf(stderr, "Failed to find sym: %p\n", (void *)plugin);
+            EXIT(1);
+        }
+
+        rule_plugin_handles[i] = handle;
+        rule_plugins[i] = plugin;
+    }
+
+    loadPatternPlugins();
+
+    return SLICE(RulePlugin *, rule_plugins);
+}
+
+auto unloadRulePlugins() -> void {
+    unloadPatternPlugins();
+    for (void *handle : rule_plugin_handles) {
+        dlclose(handle);
+    }
+}
@@ -3,13 +3,51 @@
 #include "solver.h"
 
 #include "arena.cc"
-#include "linkedlist.cc"
 #include "strslice.cc"
 
 #include <assert.h>
 #include <stdio.h>
 
 auto initSolver(GridSolver *solver, GridApi api) -> void {
-    LinkedList<GridSolver::Rule>::initSentinel(&solver->rule_sentinel);
+    initSolver(solver, api, SolveMode::sm_sweep);
+}
+
+auto initSolver(GridSolver *solver, GridApi api, SolveMode mode) -> void {
+    solver->rules = Slice<GridSolver::Rule>{nullptr, 0};
+#ifdef SOLVER_PROFILE
+    solver->stats = Slice<RuleStats>{nullptr, 0};
+    solver->cells_changed = 0;
+#endif
+    solver->rule_cap = 0;
+    solver->start_rules = Slice<size_t>{nullptr, 0};
+    solver->finish_rules = Slice<size_t>{nullptr, 0};
+    solver->order = Slice<size_t>{nullptr, 0};
+    solver->max_tier = 0;
+    solver->policy = RulePolicy::rp_tiered;
     solver->api = api;
+    solver->mode = mode;
+    solver->board_arena = Arena{};
+
+    // profiling counts changes through the listener in either mode
+#ifdef SOLVER_PROFILE
+    bool listen = true;
+#else
+    bool listen = mode == SolveMode::sm_worklist;
+#endif
+    if (listen) {
+        solver->api.cellChanged = &GridSolver::onCellChanged;
+        solver->api.listener = solver;
+    }
+}
+
+auto deinitSolver(GridSolver *solver) -> void {
+    if (solver->worklist.arena.ptr != nullptr) {
+        freeArena(&solver->worklist.arena);
+    }
+    solver->worklist = Worklist{};
+
+    if (solver->board_arena.ptr != nullptr) {
+        freeArena(&solver->board_arena);
+    }
+    solver->board_arena = Arena{};
 }
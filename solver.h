@@ -3,11 +3,39 @@
 #include "grid.h"
 
 #include "arena.cc"
-#include "linkedlist.cc"
+#include "dirutils.cc"
+#include "op.cc"
+#include "slice.cc"
 #include "strslice.cc"
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#ifdef SOLVER_PROFILE
+#include "utils.cc"
+#endif
+
+enum SolveMode {
+    sm_sweep,    // visit every (row, col, rule) each epoch
+    sm_worklist, // only revisit cells near changes made through the api
+};
+
+// Rules are grouped by what they cost per call. A tier only runs once every
+// cheaper tier has gone a whole epoch without progress, and any progress
+// drops back to the cheapest tier. The epoch that lets a tier in only runs
+// that tier, the cheaper ones have just been over the same grid.
+enum RuleTier : unsigned char {
+    rt_local,   // a few reads around the cell
+    rt_pattern, // generated pattern matches
+    rt_region,  // reasoning over the constraints around the cell
+    rt_exact,   // enumerating whole frontier components
+};
+
+enum RulePolicy {
+    rp_flat,   // every rule runs every epoch, in registration order
+    rp_tiered, // cheaper tiers first, see RuleTier
+};
 
 struct SolveState {
     size_t row;
@@ -16,6 +44,118 @@ struct SolveState {
     bool did_epoch_work;
     size_t last_work_rule;
     bool invalid;
+
+    // the tiers running this epoch, and the part of the rule order they
+    // cover, [first_rule, active_rules)
+    unsigned char first_tier;
+    unsigned char tier;
+    size_t first_rule;
+    size_t active_rules;
+
+    // rule calls since the last reset, and how many of them did something
+    size_t applied;
+    size_t worked;
+
+    // worklist mode only
+    size_t epoch_remaining;
+    bool full_epoch;
+};
+
+// What one rule has cost and done since the stats were last cleared, only
+// recorded when built with SOLVER_PROFILE. The time includes the rule's epoch
+// callbacks.
+struct RuleStats {
+    size_t calls;
+    size_t worked;        // calls that returned true
+    size_t cells_changed; // display changes made through the api
+    uint64_t ns;
+};
+
+struct Worklist {
+    enum Mark : unsigned char {
+        wm_queued = 1 << 0,
+    };
+
+    Arena arena;
+    Dims dims;
+    Slice<size_t> queue; // ring buffer of cell indices
+    Slice<unsigned char> marks;
+    size_t head;
+    size_t len;
+
+    auto reserve(Dims dims) -> void {
+        size_t cell_count = dims.area();
+        size_t needed = cell_count * (sizeof(size_t) + sizeof(char));
+
+        if (this->arena.cap < needed) {
+            if (this->arena.ptr != nullptr) {
+                freeArena(&this->arena);
+            }
+            this->arena = makeArena(needed);
+        }
+        this->arena.reset(0);
+
+        this->dims = dims;
+        this->queue = Slice<size_t>{this->arena.pushTN<size_t>(cell_count),
+                                    cell_count};
+        this->marks = Slice<unsigned char>{
+            this->arena.pushTN<unsigned char>(cell_count), cell_count};
+        this->head = 0;
+        this->len = 0;
+    }
+
+    auto covers(Dims dims) -> bool {
+        return this->dims.width == dims.width &&
+               this->dims.height == dims.height;
+    }
+
+    auto push(size_t idx) -> void {
+        unsigned char &mark = this->marks[idx];
+        if (mark & Mark::wm_queued) {
+            return;
+        }
+        mark |= Mark::wm_queued;
+
+        this->queue[(this->head + this->len) % this->queue.len] = idx;
+        ++this->len;
+    }
+
+    auto pop() -> size_t {
+        assert(this->len > 0 && "Popping empty worklist");
+
+        size_t idx = this->queue[this->head];
+        this->head = (this->head + 1) % this->queue.len;
+        --this->len;
+
+        this->marks[idx] &= ~Mark::wm_queued;
+        return idx;
+    }
+
+    auto pushAll() -> void {
+        for (size_t idx = 0; idx < this->queue.len; ++idx) {
+            this->push(idx);
+        }
+    }
+
+    auto pushAround(Location loc, size_t radius) -> void {
+        size_t row_s = loc.row > radius ? loc.row - radius : 0;
+        size_t col_s = loc.col > radius ? loc.col - radius : 0;
+        size_t row_e = loc.row + radius + 1;
+        size_t col_e = loc.col + radius + 1;
+
+        if (row_e > this->dims.height) {
+            row_e = this->dims.height;
+        }
+        if (col_e > this->dims.width) {
+            col_e = this->dims.width;
+        }
+
+        for (size_t r = row_s; r < row_e; ++r) {
+            for (size_t c = col_s; c < col_e; ++c) {
+                this->push(r * this->dims.width + c);
+            }
+        }
+    }
 };
 
 struct GridSolver {
@@ -31,6 +171,7 @@ struct GridSolver {
         OnEpochFinish *onFinish;
         void *data;
         StrSlice name;
+        unsigned char tier; // a RuleTier, rt_local unless set
 
         static auto from(Apply *apply_fn, StrSlice name) -> Rule {
             Rule rule{apply_fn, nullptr, nullptr, nullptr, name};
@@ -68,40 +209,213 @@ struct GridSolver {
         }
     };
 
+    // Every rule reads at most three cells away from the cell it is applied
+    // to (patterns are anchored at their top-left corner and span up to four
+    // cells, one_of_aware looks at options rooted two cells away), so that is
+    // how far a change has to be propagated in worklist mode.
+    static constexpr size_t dirty_radius = 3;
+
     GridApi api;
-    LinkedList<Rule> rule_sentinel;
-    size_t rule_count;
+    Slice<Rule> rules; // in registration order
+    size_t rule_cap;
+    // indices into rules, so epoch boundaries skip rules without callbacks
+    Slice<size_t> start_rules;
+    Slice<size_t> finish_rules;
+    // indices into rules, cheapest tier first and in registration order within
+    // a tier; the order is applied in, so a step only needs a prefix of it
+    Slice<size_t> order;
+    unsigned char max_tier;
+    SolveMode mode;
+    RulePolicy policy;
+    Worklist worklist;
     SolveState state;
+    Arena board_arena; // the copy solvableFrom plays on
+
+#ifdef SOLVER_PROFILE
+    Slice<RuleStats> stats; // parallel to rules
+    size_t cells_changed;   // every change the listener has seen
+#endif
+
+    static auto onCellChanged(Grid *grid, Location loc, void *data) -> void {
+        auto solver = static_cast<GridSolver *>(data);
+        solver->cellChanged(grid, loc);
+    }
 
     auto registerRule(Arena *arena, Rule rule) -> void {
         // TODO(bhester): assert no duplicate rules
 
-        LinkedList<Rule> *ll = arena->pushT<LinkedList<Rule>>({rule});
+        if (this->rules.len == this->rule_cap) {
+            this->growRules(arena);
+        }
 
-        this->rule_sentinel.enqueue(ll);
-        ++this->rule_count;
+        this->rules.ptr[this->rules.len++] = rule;
+#ifdef SOLVER_PROFILE
+        this->stats.ptr[this->stats.len++] = RuleStats{};
+#endif
+        this->rebuildDispatch();
 
         this->state.invalid = true;
     }
 
     auto deregisterRule(StrSlice name) -> Rule {
-        LinkedList<Rule> *ll = &this->rule_sentinel;
-        while ((ll = ll->next) != &this->rule_sentinel) {
-            if (ll->val.name.eql(name)) {
-                ll->next->prev = ll->prev;
-                ll->prev->next = ll->next;
+        for (size_t idx = 0; idx < this->rules.len; ++idx) {
+            Rule rule = this->rules[idx];
+            if (!rule.name.eql(name)) {
+                continue;
+            }
 
-                // FIXME(bhester): free list of rules?
+            for (size_t i = idx + 1; i < this->rules.len; ++i) {
+                this->rules[i - 1] = this->rules[i];
+            }
+            --this->rules.len;
+#ifdef SOLVER_PROFILE
+            for (size_t i = idx + 1; i < this->stats.len; ++i) {
+                this->stats[i - 1] = this->stats[i];
+            }
+            --this->stats.len;
+#endif
+            this->rebuildDispatch();
 
-                --this->rule_count;
+            this->state.invalid = true;
 
-                return ll->val;
-            }
+            return rule;
         }
 
         assert(0 && "Rule not found");
     }
 
+    auto growRules(Arena *arena) -> void {
+        // the old table is left in whichever arena it came from; doubling
+        // bounds the waste
+        size_t new_cap = this->rule_cap == 0 ? 16 : 2 * this->rule_cap;
+
+        Rule *rules = arena->pushTN<Rule>(new_cap);
+        for (size_t i = 0; i < this->rules.len; ++i) {
+            rules[i] = this->rules[i];
+        }
+
+        this->rules.ptr = rules;
+#ifdef SOLVER_PROFILE
+        RuleStats *stats = arena->pushTN<RuleStats>(new_cap);
+        for (size_t i = 0; i < this->stats.len; ++i) {
+            stats[i] = this->stats[i];
+        }
+        this->stats.ptr = stats;
+#endif
+        this->start_rules.ptr = arena->pushTN<size_t>(new_cap);
+        this->finish_rules.ptr = arena->pushTN<size_t>(new_cap);
+        this->order.ptr = arena->pushTN<size_t>(new_cap);
+        this->rule_cap = new_cap;
+    }
+
+    auto rebuildDispatch() -> void {
+        this->start_rules.len = 0;
+        this->finish_rules.len = 0;
+
+        for (size_t idx = 0; idx < this->rules.len; ++idx) {
+            Rule &rule = this->rules[idx];
+            if (rule.onStart != nullptr) {
+                this->start_rules.ptr[this->start_rules.len++] = idx;
+            }
+            if (rule.onFinish != nullptr) {
+                this->finish_rules.ptr[this->finish_rules.len++] = idx;
+            }
+        }
+
+        this->max_tier = 0;
+        for (Rule &rule : this->rules) {
+            if (rule.tier > this->max_tier) {
+                this->max_tier = rule.tier;
+            }
+        }
+
+        // flat keeps registration order by treating every rule as one tier
+        this->order.len = 0;
+        for (size_t tier = 0; tier <= this->max_tier; ++tier) {
+            for (size_t idx = 0; idx < this->rules.len; ++idx) {
+                if (this->policy == RulePolicy::rp_flat ||
+                    this->rules[idx].tier == tier) {
+                    this->order.ptr[this->order.len++] = idx;
+                }
+            }
+            if (this->policy == RulePolicy::rp_flat) {
+                break;
+            }
+        }
+    }
+
+    auto setPolicy(RulePolicy policy) -> void {
+        this->policy = policy;
+        this->rebuildDispatch();
+        this->state.invalid = true;
+    }
+
+    // the cheapest tier any rule has; flat runs them all as one
+    auto lowestTier() -> unsigned char {
+        if (this->policy == RulePolicy::rp_flat) {
+            return this->max_tier;
+        }
+
+        unsigned char lowest = this->max_tier;
+        for (Rule &rule : this->rules) {
+            if (rule.tier < lowest) {
+                lowest = rule.tier;
+            }
+        }
+        return lowest;
+    }
+
+    // every tier up to tier
+    auto setTier(unsigned char tier) -> void { this->setTiers(0, tier); }
+
+    auto setTiers(unsigned char first, unsigned char last) -> void {
+        this->state.first_tier = first;
+        this->state.tier = last;
+
+        // flat order is not by tier, but then first is 0 and last the top
+        size_t begin = 0;
+        while (begin < this->order.len &&
+               this->rules[this->order[begin]].tier < first) {
+            ++begin;
+        }
+        size_t end = begin;
+        while (end < this->order.len &&
+               this->rules[this->order[end]].tier <= last) {
+            ++end;
+        }
+        this->state.first_rule = begin;
+        this->state.active_rules = end;
+    }
+
+    auto tierActive(Rule &rule) -> bool {
+        return rule.tier >= this->state.first_tier &&
+               rule.tier <= this->state.tier;
+    }
+
+    // called once a full epoch has finished or one made progress, returns
+    // whether to keep going: after progress every tier from the cheapest goes
+    // again, without it only the next tier runs, the ones before it just
+    // found nothing on this same grid
+    auto nextTier() -> bool {
+        if (this->state.did_epoch_work) {
+            this->setTier(this->lowestTier());
+            return true;
+        }
+        if (this->state.tier < this->max_tier) {
+            unsigned char next = this->state.tier + 1;
+            this->setTiers(next, next);
+            return true;
+        }
+        return false;
+    }
+
+    // no rule runs at the current tiers, so the epoch is over as it starts
+    auto emptyEpoch(Grid *grid) -> bool {
+        this->startEpoch(grid);
+        this->finishEpoch(grid);
+        return this->nextTier();
+    }
+
     auto step(Grid *grid) -> bool {
         bool did_work = false;
         bool should_continue = true;
@@ -116,29 +430,33 @@ struct GridSolver {
             this->reset(grid);
         }
 
-        if (this->state.row == 0 && this->state.col == 0 &&
-            this->state.rule == 0) {
-            LinkedList<Rule> *ll = &this->rule_sentinel;
-            while ((ll = ll->next) != &this->rule_sentinel) {
-                ll->val.onEpochStart(grid, this->api);
-            }
-
-            this->state.did_epoch_work = false;
+        switch (this->mode) {
+        case sm_sweep: {
+            return this->stepSweep(grid, did_work);
+        }
+        case sm_worklist: {
+            return this->stepWorklist(grid, did_work);
+        }
         }
 
-        size_t rule_to_apply = this->state.rule++;
-        Rule &rule = this->ruleAt(rule_to_apply);
-        *did_work =
-            rule.applyRule(grid, this->api, this->state.row, this->state.col);
+        assert(0 && "Unreachable");
+    }
 
-        if (*did_work) {
-            this->state.did_epoch_work = true;
-            this->state.last_work_rule = rule_to_apply;
+    auto stepSweep(Grid *grid, bool *did_work) -> bool {
+        if (this->state.first_rule == this->state.active_rules) {
+            return this->emptyEpoch(grid);
+        }
+
+        if (this->state.row == 0 && this->state.col == 0 &&
+            this->state.rule == this->state.first_rule) {
+            this->startEpoch(grid);
         }
 
+        *did_work = this->applyNextRule(grid);
+
         bool has_next_step = true;
-        if (this->state.rule == this->rule_count) {
-            this->state.rule = 0;
+        if (this->state.rule == this->state.active_rules) {
+            this->state.rule = this->state.first_rule;
             ++this->state.col;
 
             if (this->state.col == grid->dims.width) {
@@ -148,14 +466,59 @@ struct GridSolver {
                 if (this->state.row == grid->dims.height) {
                     this->state.row = 0;
 
-                    LinkedList<Rule> *ll = &this->rule_sentinel;
-                    while ((ll = ll->next) != &this->rule_sentinel) {
-                        rule.onEpochFinish(grid, this->api);
-                    }
+                    this->finishEpoch(grid);
+                    has_next_step = this->nextTier();
+                    this->state.rule = this->state.first_rule;
+                }
+            }
+        }
 
-                    if (!this->state.did_epoch_work) {
-                        has_next_step = false;
-                    }
+        return has_next_step;
+    }
+
+    auto stepWorklist(Grid *grid, bool *did_work) -> bool {
+        Worklist &worklist = this->worklist;
+
+        if (this->state.first_rule == this->state.active_rules) {
+            return this->emptyEpoch(grid);
+        }
+
+        if (this->state.rule == this->state.first_rule) {
+            if (this->state.epoch_remaining == 0) {
+                // An epoch covers the cells that were queued when it started.
+                // Once nothing is queued, sweep everything one more time so
+                // rules that depend on more than the neighborhood (like
+                // click_remaining_cells) still get their chance; only an
+                // unproductive full epoch ends the solve, same as a sweep.
+                this->state.full_epoch = worklist.len == 0;
+                if (this->state.full_epoch) {
+                    worklist.pushAll();
+                }
+
+                this->state.epoch_remaining = worklist.len;
+                this->startEpoch(grid);
+            }
+
+            size_t idx = worklist.pop();
+            this->state.row = idx / grid->dims.width;
+            this->state.col = idx % grid->dims.width;
+        }
+
+        *did_work = this->applyNextRule(grid);
+
+        bool has_next_step = true;
+        if (this->state.rule == this->state.active_rules) {
+            this->state.rule = this->state.first_rule;
+
+            if (--this->state.epoch_remaining == 0) {
+                this->finishEpoch(grid);
+
+                // escalating needs a full epoch to have found nothing, an
+                // epoch over just the queued cells proves nothing about the
+                // rest of the grid
+                if (this->state.did_epoch_work || this->state.full_epoch) {
+                    has_next_step = this->nextTier();
+                    this->state.rule = this->state.first_rule;
                 }
             }
         }
@@ -163,16 +526,101 @@ struct GridSolver {
         return has_next_step;
     }
 
-    auto ruleAt(size_t idx) -> Rule & {
-        assert(idx < this->rule_count);
+    auto applyNextRule(Grid *grid) -> bool {
+        size_t rule_to_apply = this->order[this->state.rule++];
+        Rule &rule = this->ruleAt(rule_to_apply);
 
-        size_t i = 0;
-        LinkedList<Rule> *ll = &this->rule_sentinel;
-        while ((ll = ll->next) != &this->rule_sentinel && i < idx) {
-            ++i;
+#ifdef SOLVER_PROFILE
+        uint64_t start_ns = nanoTime();
+        size_t changed_before = this->cells_changed;
+#endif
+        bool did_work =
+            rule.applyRule(grid, this->api, this->state.row, this->state.col);
+#ifdef SOLVER_PROFILE
+        RuleStats &stats = this->stats[rule_to_apply];
+        ++stats.calls;
+        stats.worked += did_work;
+        stats.cells_changed += this->cells_changed - changed_before;
+        stats.ns += nanoTime() - start_ns;
+#endif
+
+        ++this->state.applied;
+        if (did_work) {
+            ++this->state.worked;
+            this->state.did_epoch_work = true;
+            this->state.last_work_rule = rule_to_apply;
         }
 
-        return ll->val;
+        return did_work;
+    }
+
+    auto startEpoch(Grid *grid) -> void {
+        for (size_t idx : this->start_rules) {
+            Rule &rule = this->rules[idx];
+            if (!this->tierActive(rule)) {
+                continue;
+            }
+#ifdef SOLVER_PROFILE
+            uint64_t start_ns = nanoTime();
+            rule.onStart(grid, this->api, rule.data);
+            this->stats[idx].ns += nanoTime() - start_ns;
+#else
+            rule.onStart(grid, this->api, rule.data);
+#endif
+        }
+
+        this->state.did_epoch_work = false;
+    }
+
+    auto finishEpoch(Grid *grid) -> void {
+        for (size_t idx : this->finish_rules) {
+            Rule &rule = this->rules[idx];
+            if (!this->tierActive(rule)) {
+                continue;
+            }
+#ifdef SOLVER_PROFILE
+            uint64_t start_ns = nanoTime();
+            rule.onFinish(grid, this->api, rule.data);
+            this->stats[idx].ns += nanoTime() - start_ns;
+#else
+            rule.onFinish(grid, this->api, rule.data);
+#endif
+        }
+    }
+
+    auto cellChanged(Grid *grid, Location loc) -> void {
+#ifdef SOLVER_PROFILE
+        ++this->cells_changed;
+#endif
+
+        // changes to a grid we are not tracking are picked up by the reset
+        // once the solver is pointed at it
+        if (!this->worklist.covers(grid->dims)) {
+            return;
+        }
+
+        this->worklist.pushAround(loc, dirty_radius);
+    }
+
+    auto ruleAt(size_t idx) -> Rule & { return this->rules[idx]; }
+
+    // empty unless built with SOLVER_PROFILE
+    auto ruleStats(size_t idx) -> Op<RuleStats> {
+#ifdef SOLVER_PROFILE
+        return this->stats[idx];
+#else
+        (void)idx;
+        return Op<RuleStats>::empty();
+#endif
+    }
+
+    auto clearStats() -> void {
+#ifdef SOLVER_PROFILE
+        for (RuleStats &stats : this->stats) {
+            stats = RuleStats{};
+        }
+        this->cells_changed = 0;
+#endif
     }
 
     auto reset(Grid *grid) -> void {
@@ -184,14 +632,21 @@ struct GridSolver {
         this->state.did_epoch_work = false;
         this->state.last_work_rule = 0;
         this->state.invalid = false;
+        this->state.applied = 0;
+        this->state.worked = 0;
+        this->state.epoch_remaining = 0;
+        this->state.full_epoch = false;
+        this->setTier(this->lowestTier());
+        this->state.rule = this->state.first_rule;
+
+        if (this->mode == SolveMode::sm_worklist) {
+            this->worklist.reserve(grid->dims);
+        }
     }
 
     auto resetEpoch(Grid *grid) -> void {
         // close out any epochs
-        LinkedList<Rule> *ll = &this->rule_sentinel;
-        while ((ll = ll->next) != &this->rule_sentinel) {
-            ll->val.onEpochFinish(grid, this->api);
-        }
+        this->finishEpoch(grid);
     }
 
     auto solvable(Grid *grid) -> bool {
@@ -201,18 +656,84 @@ struct GridSolver {
 
         return gridSolved(*grid);
     }
-};
 
-#define REGISTERER(Name, arena, solver)                                        \
-    void(Name)(Arena * arena, GridSolver * solver)
-#define DEREGISTERER(Name, solver) void(Name)(GridSolver * solver)
+    // Copies grid onto board_arena, uncovers start on the copy and resets to
+    // it, so the copy can be stepped while grid stays as it was. The copy is
+    // good until the next call.
+    auto startFrom(Grid const &grid, Location start) -> Grid {
+        size_t cell_count = grid.cells.len;
+        size_t needed = gridArenaSize(grid.dims);
+        if (this->board_arena.cap < needed) {
+            if (this->board_arena.ptr != nullptr) {
+                freeArena(&this->board_arena);
+            }
+            this->board_arena = makeArena(needed);
+        }
+        this->board_arena.reset(0);
+
+        Grid board = grid;
+        board.cells = Slice<Cell>{this->board_arena.pushTN<Cell>(cell_count),
+                                  cell_count};
+        board.scratch = &this->board_arena;
+        board.journal = nullptr;
+        for (size_t i = 0; i < cell_count; ++i) {
+            board.cells[i] = grid.cells.ptr[i];
+        }
 
-typedef REGISTERER(RuleRegisterer, arena, solver);
+        this->api.uncoverSelfAndNeighbors(&board, start);
+        this->reset(&board);
+        return board;
+    }
+
+    // solvable without touching grid, any number of solvers can check the
+    // same grid at once
+    auto solvableFrom(Grid const &grid, Location start) -> bool {
+        Grid board = this->startFrom(grid, start);
+        while (this->step(&board))
+            ;
+
+        bool solved = gridSolved(board);
+        this->resetEpoch(&board);
+        this->state.invalid = true;
+        return solved;
+    }
+};
+
+// A plugin keeps no state of its own. Whatever its rules need between calls
+// is made by makeState once per solver it is registered with and handed to
+// regRule, which registers it as the rules' data; deregRule gives it back to
+// be freed. Stateless plugins leave makeState and freeState null and get a
+// null state.
+#define REGISTERER(Name, arena, solver, state)                                 \
+    void(Name)(Arena * arena, GridSolver * solver, void *state)
+#define DEREGISTERER(Name, solver) auto(Name)(GridSolver * solver) -> void *
+#define STATE_MAKER(Name) auto(Name)() -> void *
+#define STATE_FREER(Name, state) void(Name)(void *state)
+
+typedef REGISTERER(RuleRegisterer, arena, solver, state);
 typedef DEREGISTERER(RuleDeregisterer, solver);
+typedef STATE_MAKER(RuleStateMaker);
+typedef STATE_FREER(RuleStateFreer, state);
 
 struct RulePlugin {
     RuleRegisterer *regRule;
     RuleDeregisterer *deregRule;
+    RuleStateMaker *makeState;
+    RuleStateFreer *freeState;
+
+    auto registerWith(Arena *arena, GridSolver *solver) -> void {
+        void *state = this->makeState != nullptr ? this->makeState() : nullptr;
+        this->regRule(arena, solver, state);
+    }
+
+    auto deregisterFrom(GridSolver *solver) -> void {
+        void *state = this->deregRule(solver);
+        if (this->freeState != nullptr) {
+            this->freeState(state);
+        }
+    }
 };
 
 auto initSolver(GridSolver *solver, GridApi api) -> void;
+auto initSolver(GridSolver *solver, GridApi api, SolveMode mode) -> void;
+auto deinitSolver(GridSolver *solver) -> void;
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 
 #define ARRAY_LEN(a) (sizeof(a) / sizeof(*a))
 
@@ -17,6 +19,23 @@
 
 auto myExit(int code) -> void { exit(code); }
 
+auto nanoTime() -> uint64_t {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// the whole string has to be a decimal number
+auto parseU64(char const *str, uint64_t *out) -> bool {
+    if (str == nullptr || *str < '0' || *str > '9') {
+        return false;
+    }
+
+    char *end;
+    *out = strtoull(str, &end, 10);
+    return *end == '\0';
+}
+
 template <typename T> auto clamp(T min_val, T val, T max_val) -> T {
     assert(min_val <= max_val && "Invalid clamp range");
 